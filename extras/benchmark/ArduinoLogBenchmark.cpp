@@ -0,0 +1,153 @@
+/**
+ * Native benchmark of the formatter and output path (see the [env:benchmark] environment in
+ * platformio.ini). Run with
+ *
+ *   pio run -e benchmark -t exec
+ *
+ * Every workload logs to a sink that only counts the Print calls and bytes it receives, so the
+ * numbers are the cost of ArduinoLog itself. Each workload runs kRuns times and the fastest run
+ * is reported, as one JSON object per line:
+ *
+ *   {"workload":"plain","lines":200000,"ns_per_line":41.2,"lines_per_sec":24271845,
+ *    "print_calls_per_line":1.00,"bytes_per_line":38.0}
+ *
+ * An optional argument sets the number of lines per run.
+ */
+#include "ArduinoLog.hpp"
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+
+namespace {
+
+const int kRuns = 3;
+
+class CountingSink : public Print {
+  public:
+    size_t write(uint8_t) override {
+      ++calls;
+      ++bytes;
+      return 1;
+    }
+
+    size_t write(const uint8_t*, size_t size) override {
+      ++calls;
+      bytes += size;
+      return size;
+    }
+
+    unsigned long long calls = 0;
+    unsigned long long bytes = 0;
+};
+
+CountingSink sink;
+Logging BenchLog("Bench");
+
+// Advances by a millisecond per reading, so prefixed timestamps change from line to line
+unsigned long tick = 0;
+unsigned long benchClock() { return ++tick; }
+
+struct Workload {
+  const char* name;
+  void (*setUp)();
+  void (*line)(unsigned long i);
+};
+
+void defaults() {}
+
+void prefixed() {
+  Logging::setPrefix("%M %L %n: ");
+}
+
+void warningsOnly() {
+  Logging::setLevel(LOG_LEVEL_WARNING);
+}
+
+void binary() {
+  Logging::setBinaryMode(true);
+}
+
+const Workload kWorkloads[] = {
+  {"plain", defaults, [](unsigned long) {
+    BenchLog.info("Plain text message without any arguments");
+  }},
+  {"numeric", defaults, [](unsigned long i) {
+    BenchLog.info("n=%d l=%l u=%u x=%x X=%X b=%b", (int) i, (long) i * 7919, i * 104729, (int) i,
+                  (int) i, (int) (i & 0xFF));
+  }},
+  {"numeric_macro", defaults, [](unsigned long i) {
+    LOG_INFO(BenchLog, "n=%d l=%l u=%u x=%x X=%X b=%b", (int) i, (long) i * 7919, i * 104729, (int) i,
+             (int) i, (int) (i & 0xFF));
+  }},
+  {"float", defaults, [](unsigned long i) {
+    BenchLog.info("t=%f v=%.3f p=%.1f", i * 0.25, i / 7.0, -1.5 * i);
+  }},
+  {"flash", defaults, [](unsigned long i) {
+    BenchLog.info(F("Flash format with %S and a number %d"), F("a flash string argument"), (int) i);
+  }},
+  {"prefixed", prefixed, [](unsigned long i) {
+    BenchLog.info("Prefixed line %d", (int) i);
+  }},
+  {"disabled", warningsOnly, [](unsigned long i) {
+    BenchLog.trace("Disabled %d %s", (int) i, "text");
+  }},
+  {"disabled_macro", warningsOnly, [](unsigned long i) {
+    LOG_TRACE(BenchLog, "Disabled %d %s", (int) i, "text");
+  }},
+  {"binary_numeric", binary, [](unsigned long i) {
+    BenchLog.info("n=%d l=%l u=%u x=%x X=%X b=%b", (int) i, (long) i * 7919, i * 104729, (int) i,
+                  (int) i, (int) (i & 0xFF));
+  }},
+  {"event_json", defaults, [](unsigned long i) {
+    LogEvent(BenchLog, LOG_LEVEL_INFO, "reading").add("n", (int) i).add("u", i * 104729).add("t", i * 0.25);
+  }},
+  {"event_binary", binary, [](unsigned long i) {
+    LogEvent(BenchLog, LOG_LEVEL_INFO, "reading").add("n", (int) i).add("u", i * 104729).add("t", i * 0.25);
+  }},
+};
+
+void reset() {
+  Logging::setLevel(LOG_LEVEL_TRACE);
+  Logging::setOutput(&sink);
+  Logging::setClock(benchClock);
+  Logging::clearPrefix();
+  Logging::setBinaryMode(false);
+  Logging::setDigit(2);
+}
+
+}
+
+int main(int argc, char** argv) {
+  unsigned long lines = argc > 1 ? strtoul(argv[1], nullptr, 10) : 200000;
+  if (lines == 0)
+    return 1;
+
+  for (const Workload& workload : kWorkloads) {
+    double best = 0;
+    for (int run = 0; run < kRuns; ++run) {
+      reset();
+      workload.setUp();
+      sink.calls = 0;
+      sink.bytes = 0;
+
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      for (unsigned long i = 0; i < lines; ++i) {
+        workload.line(i);
+      }
+      std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+
+      if (run == 0 || elapsed.count() < best) {
+        best = elapsed.count();
+      }
+    }
+
+    double nsPerLine = best / lines;
+    printf("{\"workload\":\"%s\",\"lines\":%lu,\"ns_per_line\":%.1f,\"lines_per_sec\":%.0f,"
+           "\"print_calls_per_line\":%.2f,\"bytes_per_line\":%.1f}\n",
+           workload.name, lines, nsPerLine, nsPerLine > 0 ? 1e9 / nsPerLine : 0.0,
+           (double) sink.calls / lines, (double) sink.bytes / lines);
+  }
+  reset();
+  return 0;
+}
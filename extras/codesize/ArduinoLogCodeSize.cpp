@@ -0,0 +1,82 @@
+/**
+ * Flash taken by log call sites. The sketch has 16 method and 16 macro call sites with distinct
+ * argument types, so each one needs template instances of its own, and is built once with and once
+ * without them (see the [env:codesize] environments in platformio.ini):
+ *
+ *   pio run -e codesize
+ *   pio run -e codesize_empty
+ *
+ * The difference between the two flash sizes, divided by 32, is the cost of one call site.
+ */
+#include "ArduinoLog.hpp"
+
+#ifndef LOG_CODE_SIZE_SITES
+  #define LOG_CODE_SIZE_SITES 1
+#endif
+
+Logging Log;
+
+// Volatile, so the arguments are loaded at run time as in a real application
+volatile int intValue = 1;
+volatile long longValue = 2;
+volatile unsigned long unsignedValue = 3;
+volatile char charValue = 'c';
+volatile bool boolValue = true;
+volatile double floatValue = 4.5;
+const char* volatile text = "text";
+
+#if LOG_CODE_SIZE_SITES
+
+void logMethods() {
+  Log.critical("critical");
+  Log.error("error %d", intValue);
+  Log.warning("warning %l", longValue);
+  Log.info("info %u", unsignedValue);
+  Log.debug("debug %c", charValue);
+  Log.trace("trace %T", boolValue);
+  Log.info("float %F", floatValue);
+  Log.info("string %s", text);
+  Log.info("%d %l", intValue, longValue);
+  Log.info("%d %u", intValue, unsignedValue);
+  Log.info("%l %d", longValue, intValue);
+  Log.info("%s %d", text, intValue);
+  Log.info("%d %s", intValue, text);
+  Log.info("%c %d", charValue, intValue);
+  Log.info("%d %d %d", intValue, intValue, intValue);
+  Log.info(F("flash %d %s"), intValue, text);
+}
+
+void logMacros() {
+  LOG_CRITICAL(Log, "critical");
+  LOG_ERROR(Log, "error %d", intValue);
+  LOG_WARNING(Log, "warning %l", longValue);
+  LOG_INFO(Log, "info %u", unsignedValue);
+  LOG_DEBUG(Log, "debug %c", charValue);
+  LOG_TRACE(Log, "trace %T", boolValue);
+  LOG_INFO(Log, "float %F", floatValue);
+  LOG_INFO(Log, "string %s", text);
+  LOG_INFO(Log, "%d %l", intValue, longValue);
+  LOG_INFO(Log, "%d %u", intValue, unsignedValue);
+  LOG_INFO(Log, "%l %d", longValue, intValue);
+  LOG_INFO(Log, "%s %d", text, intValue);
+  LOG_INFO(Log, "%d %s", intValue, text);
+  LOG_INFO(Log, "%c %d", charValue, intValue);
+  LOG_INFO(Log, "%d %d %d", intValue, intValue, intValue);
+  LOG_INFO(Log, "%S %d", F("flash"), intValue);
+}
+
+#endif
+
+void setup() {
+  Serial.begin(115200);
+  Logging::setLevel(LOG_LEVEL_TRACE);
+  Logging::setOutput(&Serial);
+  Log.info("started");
+}
+
+void loop() {
+  #if LOG_CODE_SIZE_SITES
+    logMethods();
+    logMacros();
+  #endif
+}
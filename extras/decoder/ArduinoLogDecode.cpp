@@ -0,0 +1,699 @@
+/**
+ * Host-side decoder for the ArduinoLog binary stream (see src/ArduinoLogBinary.hpp).
+ *
+ * Reads a captured stream and prints each record as the text the device would have logged in
+ * text mode. Build and use with
+ *
+ *   c++ -std=c++11 -O2 -o arduinolog-decode ArduinoLogDecode.cpp
+ *   arduinolog-decode [-p prefix] [capture.bin]
+ *
+ * The optional prefix accepts the internal variables %L (level), %m (milliseconds) and
+ * %M (HH:MM:SS.mmm) of the record, e.g. -p "%M %L ". Without a file the stream is read from stdin.
+ * Events (ArduinoLogEvent.hpp) are printed as JSON lines, without the prefix.
+ */
+#include <algorithm>
+#include <ctype.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+namespace {
+
+const uint8_t kFrameSync = 0xA5;
+const uint8_t kFormatWideIntegers = 0x01;
+const uint8_t kFormatTruncated = 0x02;
+const char* kTruncationMark = "...";
+const unsigned kMaxFloatDigits = 9;
+
+struct Target {
+  unsigned intSize = 2;
+  unsigned longSize = 4;
+  unsigned doubleSize = 4;
+  bool littleEndian = true;
+};
+
+struct Format {
+  bool defined = false;
+  uint8_t flags = 0;
+  std::string text;
+};
+
+// Reads the arguments of a record payload, failing once the payload is exhausted.
+class Reader {
+  public:
+    Reader(const Target& target, const uint8_t* data, size_t size)
+      : _target(target), _data(data), _size(size), _pos(0) {}
+
+    bool integer(unsigned size, bool isSigned, int64_t& value) {
+      if (_pos + size > _size)
+        return false;
+      uint64_t raw = 0;
+      for (unsigned i = 0; i < size; ++i) {
+        uint8_t byte = _data[_pos + (_target.littleEndian ? i : size - 1 - i)];
+        raw |= (uint64_t) byte << (8 * i);
+      }
+      _pos += size;
+      if (isSigned && size < 8 && (raw & ((uint64_t) 1 << (8 * size - 1)))) {
+        raw |= ~(uint64_t) 0 << (8 * size);
+      }
+      value = (int64_t) raw;
+      return true;
+    }
+
+    // Always little endian, like the record timestamp
+    bool word32(uint32_t& value) {
+      if (_pos + 4 > _size)
+        return false;
+      value = _data[_pos] | (_data[_pos + 1] << 8) | (_data[_pos + 2] << 16) | ((uint32_t) _data[_pos + 3] << 24);
+      _pos += 4;
+      return true;
+    }
+
+    bool byte(uint8_t& value) {
+      if (_pos >= _size)
+        return false;
+      value = _data[_pos++];
+      return true;
+    }
+
+    bool floating(double& value) {
+      int64_t raw;
+      unsigned size = _target.doubleSize;
+      if (!integer(size, false, raw))
+        return false;
+      if (size == 4) {
+        uint32_t bits = (uint32_t) raw;
+        float f;
+        memcpy(&f, &bits, sizeof(f));
+        value = f;
+      } else {
+        uint64_t bits = (uint64_t) raw;
+        memcpy(&value, &bits, sizeof(value));
+      }
+      return true;
+    }
+
+    // False if the terminator is missing; the text read so far is still returned.
+    bool text(std::string& value) {
+      value.clear();
+      while (_pos < _size) {
+        char c = (char) _data[_pos++];
+        if (c == 0)
+          return true;
+        value += c;
+      }
+      return false;
+    }
+
+  private:
+    const Target& _target;
+    const uint8_t* _data;
+    size_t _size;
+    size_t _pos;
+};
+
+// Mirrors LogLine and the renderers in ArduinoLogFormat.cpp.
+class Renderer {
+  public:
+    explicit Renderer(const Target& target) : _target(target) {}
+
+    std::string out;
+
+    void number(uint64_t value, unsigned base) {
+      char digits[65];
+      char* p = digits + sizeof(digits);
+      do {
+        unsigned digit = (unsigned) (value % base);
+        *--p = (char) (digit < 10 ? '0' + digit : 'A' + digit - 10);
+        value /= base;
+      } while (value != 0);
+      out.append(p, digits + sizeof(digits) - p);
+    }
+
+    // Device long, printed in base 10 with a sign and in other bases as unsigned long
+    void signedNumber(int64_t value, unsigned base) {
+      if (base == 10 && value < 0) {
+        out += '-';
+        number(0 - (uint64_t) value, 10);
+      } else {
+        number((uint64_t) value & longMask(), base);
+      }
+    }
+
+    void hexBytes(const std::string& bytes) {
+      static const char digits[] = "0123456789ABCDEF";
+      for (size_t i = 0; i < bytes.size(); ++i) {
+        if (i > 0) out += ' ';
+        out += digits[(uint8_t) bytes[i] >> 4];
+        out += digits[(uint8_t) bytes[i] & 0xF];
+      }
+    }
+
+    void hexPrefixed(uint64_t value) {
+      out += "0x";
+      for (uint64_t limit = 0x1000; limit > 1 && value < limit; limit >>= 4) {
+        out += '0';
+      }
+      number(value, 16);
+    }
+
+    void charOrHex(char c) {
+      if (c >= 0x20 && c < 0x7F) {
+        out += c;
+      } else {
+        out += "0x";
+        if ((uint8_t) c < 0x10) out += '0';
+        number((uint8_t) c, 16);
+      }
+    }
+
+    // Same fixed point steps as LogLine::appendFloat, in the precision of the device
+    template <class Real> void floating(Real value, unsigned digits) {
+      if (isnan(value)) { out += "nan"; return; }
+      if (isinf(value)) { out += value < 0 ? "-inf" : "inf"; return; }
+      if (value > (Real) 4294967040.0 || value < (Real) -4294967040.0) { out += "ovf"; return; }
+
+      if (value < 0) {
+        out += '-';
+        value = -value;
+      }
+
+      if (digits > kMaxFloatDigits) {
+        digits = kMaxFloatDigits;
+      }
+      uint32_t scale = 1;
+      for (unsigned i = 0; i < digits; ++i) {
+        scale *= 10;
+      }
+
+      uint32_t integer = (uint32_t) value;
+      uint32_t fraction = (uint32_t) ((value - (Real) integer) * (Real) scale + (Real) 0.5);
+      if (fraction >= scale) {
+        fraction -= scale;
+        ++integer;
+      }
+      number(integer, 10);
+
+      if (digits > 0) {
+        char text[16];
+        snprintf(text, sizeof(text), ".%0*lu", (int) digits, (unsigned long) fraction);
+        out += text;
+      }
+    }
+
+  private:
+    uint64_t longMask() const {
+      return _target.longSize >= 8 ? ~(uint64_t) 0 : (((uint64_t) 1 << (8 * _target.longSize)) - 1);
+    }
+
+    const Target& _target;
+};
+
+const char* levelAbbrev(int level) {
+  switch (level) {
+    case 1:  return "CRIT";
+    case 2:  return "ERRO";
+    case 3:  return "WARN";
+    case 4:  return "INFO";
+    case 5:  return "DBUG";
+    case 6:  return "TRCE";
+    default: return "UNKN";
+  }
+}
+
+void renderTimestamp(Renderer& r, uint32_t ms) {
+  char text[32];
+  snprintf(text, sizeof(text), "%02lu:%02lu:%02lu.%03lu",
+           (unsigned long) (ms / 3600000UL), (unsigned long) (ms / 60000UL % 60),
+           (unsigned long) (ms / 1000UL % 60), (unsigned long) (ms % 1000));
+  r.out += text;
+}
+
+// Renders one argument; false once the payload runs out.
+bool renderArgument(Renderer& r, Reader& in, const Target& target, const Format& format,
+                    char spec, int level, uint32_t timestamp) {
+  unsigned intSize = (format.flags & kFormatWideIntegers) ? target.longSize : target.intSize;
+  int64_t value;
+  std::string text;
+
+  switch (spec) {
+    case '%': r.out += '%'; return true;
+    case 'L': r.out += levelAbbrev(level); return true;
+    case 'm': r.number(timestamp, 10); return true;
+    case 'M': renderTimestamp(r, timestamp); return true;
+    case 'r': {
+      uint32_t memory;
+      if (!in.word32(memory)) return false;
+      r.number(memory, 10);
+      return true;
+    }
+
+    case 's': case 'S': case 'p': case 'n': {
+      bool complete = in.text(text);
+      r.out += text;
+      return complete;
+    }
+    case 'h': {
+      uint8_t size, byte;
+      if (!in.byte(size)) return false;
+      for (unsigned i = 0; i < size; ++i) {
+        if (!in.byte(byte)) {
+          r.hexBytes(text);
+          return false;
+        }
+        text += (char) byte;
+      }
+      r.hexBytes(text);
+      return true;
+    }
+    case 'v': {
+      uint8_t threshold;
+      if (!in.byte(threshold)) return false;
+      r.out += levelAbbrev(threshold);
+      return true;
+    }
+    case 'f': case 'D': case 'F': {
+      uint8_t digits;
+      double number;
+      if (!in.byte(digits) || !in.floating(number)) return false;
+      if (target.doubleSize == 4) {
+        r.floating((float) number, digits);
+      } else {
+        r.floating(number, digits);
+      }
+      return true;
+    }
+    case 'l':
+      if (!in.integer(target.longSize, true, value)) return false;
+      r.signedNumber(value, 10);
+      return true;
+    case 'u':
+      if (!in.integer(target.longSize, false, value)) return false;
+      r.number((uint64_t) value, 10);
+      return true;
+
+    // Hexadecimal and binary values are unsigned in the width they were sent with
+    case 'x': case 'X': case 'b': case 'B':
+      if (!in.integer(intSize, false, value)) return false;
+      if (spec == 'x') r.number((uint64_t) value, 16);
+      else if (spec == 'X') r.hexPrefixed((uint64_t) value);
+      else if (spec == 'b') r.number((uint64_t) value, 2);
+      else { r.out += "0b"; r.number((uint64_t) value, 2); }
+      return true;
+
+    case 'd': case 'c': case 'C': case 't': case 'T':
+      if (!in.integer(intSize, true, value)) return false;
+      if (spec == 'd') r.signedNumber(value, 10);
+      else if (spec == 'c') r.out += (char) value;
+      else if (spec == 'C') r.charOrHex((char) value);
+      else if (spec == 't') r.out += value == 1 ? "T" : "F";
+      else r.out += value == 1 ? "true" : "false";
+      return true;
+
+    default:
+      return true;
+  }
+}
+
+// Flags, width and precision between '%' and the conversion character
+struct Modifiers {
+  int precision = -1;
+  unsigned width = 0;
+  bool left = false;
+  bool zero = false;
+};
+
+// Parses the modifiers after the '%' at i and leaves i on the last of them
+Modifiers parseModifiers(const std::string& text, size_t& i) {
+  Modifiers modifiers;
+  for (; i + 1 < text.size() && (text[i + 1] == '-' || text[i + 1] == '0'); ++i) {
+    if (text[i + 1] == '-') modifiers.left = true; else modifiers.zero = true;
+  }
+  for (; i + 1 < text.size() && isdigit((unsigned char) text[i + 1]); ++i) {
+    modifiers.width = std::min(modifiers.width * 10 + (text[i + 1] - '0'), 255u);
+  }
+  if (i + 1 < text.size() && text[i + 1] == '.') {
+    modifiers.precision = 0;
+    for (++i; i + 1 < text.size() && isdigit((unsigned char) text[i + 1]); ++i) {
+      modifiers.precision = modifiers.precision * 10 + (text[i + 1] - '0');
+    }
+  }
+  return modifiers;
+}
+
+// Same as ArduinoLogFormat::padArgument(); the precision of floats is already in the record.
+void applyModifiers(std::string& out, size_t start, char spec, const Modifiers& modifiers) {
+  bool integer = strchr("dluxXbB", spec) != nullptr;
+  bool number = integer || strchr("fDF", spec) != nullptr;
+  size_t length = out.size() - start;
+  size_t lead = 0;
+  if (length > 0 && out[start] == '-') {
+    lead = 1;
+  } else if ((spec == 'X' || spec == 'B') && length > 2) {
+    lead = 2;
+  }
+
+  if (modifiers.precision >= 0) {
+    size_t precision = modifiers.precision;
+    if (integer) {
+      if (length - lead < precision)
+        out.insert(start + lead, precision - (length - lead), '0');
+    } else if (!number && length > precision) {
+      out.resize(start + precision);
+    }
+    length = out.size() - start;
+  }
+
+  if (length >= modifiers.width)
+    return;
+  size_t fill = modifiers.width - length;
+  if (modifiers.left) {
+    out.append(fill, ' ');
+  } else if (modifiers.zero && (integer ? modifiers.precision < 0
+                                         : number && isdigit((unsigned char) out[start + lead]))) {
+    out.insert(start + lead, fill, '0');
+  } else {
+    out.insert(start, fill, ' ');
+  }
+}
+
+void renderPrefix(Renderer& r, const std::string& prefix, int level, uint32_t timestamp) {
+  for (size_t i = 0; i < prefix.size(); ++i) {
+    if (prefix[i] != '%' || i + 1 == prefix.size()) {
+      r.out += prefix[i];
+      continue;
+    }
+    Modifiers modifiers = parseModifiers(prefix, i);
+    if (++i == prefix.size())
+      break;
+    char spec = prefix[i];
+    size_t start = r.out.size();
+    if (spec == 'L') r.out += levelAbbrev(level);
+    else if (spec == 'm') r.number(timestamp, 10);
+    else if (spec == 'M') renderTimestamp(r, timestamp);
+    else if (spec == '%') r.out += '%';
+    applyModifiers(r.out, start, spec, modifiers);
+  }
+}
+
+void decodeRecord(const Target& target, const std::vector<Format>& formats, const std::string& prefix,
+                  const uint8_t* payload, size_t size) {
+  if (size < 6)
+    return;
+
+  const Format& format = formats[payload[0]];
+  int level = payload[1];
+  uint32_t timestamp = payload[2] | (payload[3] << 8) | (payload[4] << 16) | ((uint32_t) payload[5] << 24);
+
+  Renderer r(target);
+  renderPrefix(r, prefix, level, timestamp);
+
+  if (!format.defined) {
+    r.out += "<unknown format " + std::to_string(payload[0]) + ">";
+  } else {
+    Reader in(target, payload + 6, size - 6);
+    const std::string& text = format.text;
+    // A format cut on the device ends the message early however many arguments there are
+    bool cut = (format.flags & kFormatTruncated) != 0;
+    for (size_t i = 0; i < text.size(); ++i) {
+      if (text[i] != '%') {
+        r.out += text[i];
+        continue;
+      }
+      Modifiers modifiers = parseModifiers(text, i);
+      if (++i == text.size())
+        break;
+      size_t start = r.out.size();
+      if (!renderArgument(r, in, target, format, text[i], level, timestamp)) {
+        cut = true;
+        break;
+      }
+      applyModifiers(r.out, start, text[i], modifiers);
+    }
+    if (cut) {
+      r.out += kTruncationMark;
+    }
+  }
+
+  r.out += '\n';
+  fputs(r.out.c_str(), stdout);
+}
+
+// CBOR map of an event frame, rendered as the JSON line LogEvent writes in text mode. Floats
+// have as many digits as they need rather than the device's setDigit() decimals.
+class EventDecoder {
+  public:
+    EventDecoder(const uint8_t* data, size_t size) : _data(data), _size(size), _pos(0) {}
+
+    // False if the payload ends before the map does
+    bool render(std::string& out) {
+      uint8_t initial;
+      if (!byte(initial) || initial != 0xBF)
+        return false;
+      out += '{';
+      for (bool first = true; ; first = false) {
+        if (_pos >= _size)
+          return false;
+        if (_data[_pos] == 0xFF) {
+          ++_pos;
+          break;
+        }
+        if (!first) out += ',';
+
+        // The fields every event has are under small integer keys
+        uint8_t major;
+        uint64_t key;
+        std::string name;
+        if (!head(major, key)) return false;
+        if (major == 0) {
+          static const char* const names[] = { "time", "level", "module", "msg", "dropped" };
+          name = key < 5 ? names[key] : std::to_string(key);
+        } else if (major != 3 || !text(key, name)) {
+          return false;
+        }
+        string(out, name);
+        out += ':';
+
+        if (major == 0 && key == 1) {
+          uint64_t level;
+          if (!head(major, level)) return false;
+          string(out, levelAbbrev((int) level));
+        } else if (!item(out)) {
+          return false;
+        }
+      }
+      out += '}';
+      return true;
+    }
+
+  private:
+    bool byte(uint8_t& value) {
+      if (_pos >= _size)
+        return false;
+      value = _data[_pos++];
+      return true;
+    }
+
+    bool head(uint8_t& major, uint64_t& value) {
+      uint8_t initial;
+      if (!byte(initial))
+        return false;
+      major = initial >> 5;
+      uint8_t info = initial & 0x1F;
+      if (info < 24) {
+        value = info;
+        return true;
+      }
+      unsigned bytes = info == 24 ? 1 : info == 25 ? 2 : info == 26 ? 4 : info == 27 ? 8 : 0;
+      if (bytes == 0 || _pos + bytes > _size)
+        return false;
+      value = 0;
+      for (unsigned i = 0; i < bytes; ++i) {
+        value = (value << 8) | _data[_pos++];
+      }
+      return true;
+    }
+
+    bool text(uint64_t size, std::string& value) {
+      if (_pos + size > _size)
+        return false;
+      value.assign(reinterpret_cast<const char*>(_data + _pos), size);
+      _pos += size;
+      return true;
+    }
+
+    bool item(std::string& out) {
+      if (_pos >= _size)
+        return false;
+      uint8_t initial = _data[_pos];
+      if (initial == 0xF4 || initial == 0xF5 || initial == 0xF6) {
+        ++_pos;
+        out += initial == 0xF4 ? "false" : initial == 0xF5 ? "true" : "null";
+        return true;
+      }
+      if (initial == 0xFA) {
+        uint8_t major;
+        uint64_t bits;
+        if (!head(major, bits)) return false;
+        uint32_t narrow = (uint32_t) bits;
+        float value;
+        memcpy(&value, &narrow, sizeof(value));
+        number(out, value, "%.7g");
+        return true;
+      }
+      if (initial == 0xFB) {
+        uint8_t major;
+        uint64_t bits;
+        if (!head(major, bits)) return false;
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        number(out, value, "%.15g");
+        return true;
+      }
+
+      uint8_t major;
+      uint64_t value;
+      if (!head(major, value)) return false;
+      if (major == 0) {
+        out += std::to_string(value);
+      } else if (major == 1) {
+        out += '-';
+        out += value == UINT64_MAX ? "18446744073709551616" : std::to_string(value + 1);
+      } else if (major == 3) {
+        std::string content;
+        if (!text(value, content)) return false;
+        string(out, content);
+      } else {
+        return false;
+      }
+      return true;
+    }
+
+    static void number(std::string& out, double value, const char* format) {
+      if (isnan(value) || isinf(value)) {
+        out += "null";
+        return;
+      }
+      char digits[32];
+      snprintf(digits, sizeof(digits), format, value);
+      out += digits;
+    }
+
+    static void string(std::string& out, const std::string& value) {
+      out += '"';
+      for (size_t i = 0; i < value.size(); ++i) {
+        char c = value[i];
+        if (c == '"' || c == '\\') {
+          out += '\\';
+          out += c;
+        } else if (c == '\n') {
+          out += "\\n";
+        } else if (c == '\r') {
+          out += "\\r";
+        } else if (c == '\t') {
+          out += "\\t";
+        } else if ((uint8_t) c < 0x20) {
+          char escape[8];
+          snprintf(escape, sizeof(escape), "\\u%04X", (unsigned) (uint8_t) c);
+          out += escape;
+        } else {
+          out += c;
+        }
+      }
+      out += '"';
+    }
+
+    const uint8_t* _data;
+    size_t _size;
+    size_t _pos;
+};
+
+void decodeEvent(const uint8_t* payload, size_t size) {
+  std::string out;
+  if (!EventDecoder(payload, size).render(out)) {
+    out += kTruncationMark;
+  }
+  out += '\n';
+  fputs(out.c_str(), stdout);
+}
+
+int usage() {
+  fprintf(stderr, "usage: arduinolog-decode [-p prefix] [capture.bin]\n");
+  return 2;
+}
+
+}
+
+int main(int argc, char** argv) {
+  std::string prefix;
+  const char* path = nullptr;
+
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+      prefix = argv[++i];
+    } else if (argv[i][0] == '-') {
+      return usage();
+    } else {
+      path = argv[i];
+    }
+  }
+
+  FILE* input = path != nullptr ? fopen(path, "rb") : stdin;
+  if (input == nullptr) {
+    perror(path);
+    return 1;
+  }
+
+  std::vector<uint8_t> stream;
+  uint8_t chunk[4096];
+  size_t read;
+  while ((read = fread(chunk, 1, sizeof(chunk), input)) > 0) {
+    stream.insert(stream.end(), chunk, chunk + read);
+  }
+  if (input != stdin) {
+    fclose(input);
+  }
+
+  Target target;
+  std::vector<Format> formats(256);
+
+  size_t pos = 0;
+  while (pos + 3 <= stream.size()) {
+    // Skip anything that is not a frame, e.g. text printed before binary mode was enabled
+    if (stream[pos] != kFrameSync) {
+      ++pos;
+      continue;
+    }
+    uint8_t type = stream[pos + 1];
+    size_t size = stream[pos + 2];
+    if ((type != 'H' && type != 'F' && type != 'R' && type != 'E') || pos + 3 + size > stream.size()) {
+      ++pos;
+      continue;
+    }
+    const uint8_t* payload = &stream[pos + 3];
+    pos += 3 + size;
+
+    if (type == 'H' && size >= 5) {
+      target.intSize = payload[1];
+      target.longSize = payload[2];
+      target.doubleSize = payload[3];
+      target.littleEndian = payload[4] != 0;
+    } else if (type == 'F' && size >= 2) {
+      Format& format = formats[payload[0]];
+      format.defined = true;
+      format.flags = payload[1];
+      format.text.assign(reinterpret_cast<const char*>(payload + 2), size - 2);
+      format.text = format.text.c_str();
+    } else if (type == 'R') {
+      decodeRecord(target, formats, prefix, payload, size);
+    } else if (type == 'E') {
+      decodeEvent(payload, size);
+    }
+  }
+
+  return 0;
+}
@@ -2,37 +2,316 @@
 
 #ifndef DISABLE_LOGGING
   int Logging::_level = LOG_LEVEL_SILENT;
-  Print* Logging::_logOutput = nullptr;
+  int Logging::_outputLevel = LOG_LEVEL_SILENT;
+  Print* Logging::_outputs[LOG_MAX_OUTPUTS];
+  int Logging::_outputLevels[LOG_MAX_OUTPUTS];
+  uint8_t Logging::_outputCount = 0;
+  const char* Logging::_moduleLevelNames[LOG_MAX_MODULE_LEVELS];
+  int Logging::_moduleLevels[LOG_MAX_MODULE_LEVELS];
+  Logging* Logging::_instances = nullptr;
+  Logging::LegacyOutput Logging::_logOutput;
   const char* Logging::_prefixFormat = nullptr;
+  uint32_t Logging::_suppressedCount = 0;
+  uint16_t Logging::_sampleState = 0xACE1;
   int Logging::_digit = 2;
+  Logging::Clock Logging::_clock = nullptr;
+  LogTimestamp Logging::_timestamp;
+  #if LOG_THREAD_SAFE
+    thread_local LogLine* Logging::_legacyLine = nullptr;
+  #else
+    LogLine* Logging::_legacyLine = nullptr;
+  #endif
+  Logging::PrefixToken Logging::_prefixTokens[LOG_PREFIX_TOKENS];
+  uint8_t Logging::_prefixTokenCount = 0;
+  bool Logging::_prefixCompiled = false;
+  bool Logging::_binaryMode = false;
+  LogRecord Logging::_record;
+  const void* Logging::_binaryFormats[LOG_BINARY_FORMATS];
+  uint8_t Logging::_binaryFormatFlags[LOG_BINARY_FORMATS];
+  uint8_t Logging::_binaryFormatCount = 0;
+  uint8_t Logging::_binaryNextFormat = 0;
+  #if LOG_ASYNC_BUFFER_SIZE > 0
+    bool Logging::_async = false;
+    uint8_t Logging::_overflowPolicy = LOG_OVERFLOW_DROP_NEWEST;
+    LogRing Logging::_ring;
+  #endif
+  #if LOG_BATCH_SIZE > 0
+    bool Logging::_batching = false;
+    unsigned long Logging::_batchMaxAge = 0;
+    int Logging::_batchFlushLevel = LOG_LEVEL_SILENT;
+    LogBatch Logging::_batch;
+  #endif
+  #if LOG_FLIGHT_RECORDER
+    LogFlightRecorder Logging::_recorder;
+    int Logging::_recorderLevel = LOG_LEVEL_SILENT;
+  #endif
+  #if LOG_STATISTICS
+    LogStatistics Logging::_statistics;
+    Logging::Clock Logging::_statisticsClock = nullptr;
+  #endif
+  #if LOG_THREAD_SAFE
+    std::recursive_mutex Logging::_mutex;
+    std::recursive_mutex Logging::_recordMutex;
+  #endif
 #endif
 
-Logging::Logging(const char* moduleName):
-  _currentLevel(LOG_LEVEL_SILENT),
-  _moduleName(moduleName)
-{}
+#ifndef DISABLE_LOGGING
+  Logging::Logging(const char* moduleName):
+    _moduleLevel(findModuleLevel(moduleName)),
+    _moduleName(moduleName)
+  {
+    link();
+  }
+
+  Logging::Logging(const Logging& other):
+    _moduleLevel(other._moduleLevel),
+    _moduleName(other._moduleName)
+  {
+    link();
+  }
+
+  Logging& Logging::operator=(const Logging& other) {
+    _moduleLevel = other._moduleLevel;
+    _moduleName = other._moduleName;
+    updateInstanceLevel();
+    return *this;
+  }
+
+  Logging::~Logging() {
+    for (Logging** p = &_instances; *p != nullptr; p = &(*p)->_next) {
+      if (*p == this) {
+        *p = _next;
+        break;
+      }
+    }
+  }
+
+  void Logging::link() {
+    _next = _instances;
+    _instances = this;
+    updateInstanceLevel();
+  }
+#else
+  Logging::Logging(const char*) {}
+  Logging::Logging(const Logging&) {}
+  Logging& Logging::operator=(const Logging&) { return *this; }
+  Logging::~Logging() {}
+#endif
 
 void Logging::setLevel(int level) {
   #ifndef DISABLE_LOGGING
     _level = level;
+    updateEnabledLevel();
+  #endif
+}
+
+bool Logging::setModuleLevel(const char* moduleName, int level) {
+  #ifndef DISABLE_LOGGING
+    if (moduleName == nullptr)
+      return false;
+
+    uint8_t slot = LOG_MAX_MODULE_LEVELS;
+    for (uint8_t i = 0; i < LOG_MAX_MODULE_LEVELS; ++i) {
+      if (_moduleLevelNames[i] != nullptr && strcmp(_moduleLevelNames[i], moduleName) == 0) {
+        slot = i;
+        break;
+      }
+      if (_moduleLevelNames[i] == nullptr && slot == LOG_MAX_MODULE_LEVELS) {
+        slot = i;
+      }
+    }
+    if (slot == LOG_MAX_MODULE_LEVELS && level != LOG_LEVEL_INHERIT)
+      return false;
+    if (slot < LOG_MAX_MODULE_LEVELS) {
+      _moduleLevelNames[slot] = level != LOG_LEVEL_INHERIT ? moduleName : nullptr;
+      _moduleLevels[slot] = level;
+    }
+
+    // Names are only compared here, never when logging
+    for (Logging* log = _instances; log != nullptr; log = log->_next) {
+      if (log->_moduleName != nullptr && strcmp(log->_moduleName, moduleName) == 0) {
+        log->_moduleLevel = level;
+        log->updateInstanceLevel();
+      }
+    }
+    return true;
+  #else
+    return false;
+  #endif
+}
+
+int Logging::getLevel() const {
+  #ifndef DISABLE_LOGGING
+    return _moduleLevel != LOG_LEVEL_INHERIT ? _moduleLevel : _level;
+  #else
+    return LOG_LEVEL_SILENT;
+  #endif
+}
+
+int Logging::findModuleLevel(const char* moduleName) {
+  #ifndef DISABLE_LOGGING
+    if (moduleName != nullptr) {
+      for (uint8_t i = 0; i < LOG_MAX_MODULE_LEVELS; ++i) {
+        if (_moduleLevelNames[i] != nullptr && strcmp(_moduleLevelNames[i], moduleName) == 0) {
+          return _moduleLevels[i];
+        }
+      }
+    }
+  #endif
+  return LOG_LEVEL_INHERIT;
+}
+
+void Logging::updateInstanceLevel() {
+  #ifndef DISABLE_LOGGING
+    int threshold = getLevel();
+    int highest = _outputLevel;
+    #if LOG_FLIGHT_RECORDER
+      if (_recorderLevel > highest) {
+        highest = _recorderLevel;
+      }
+    #endif
+    _enabledLevel = threshold < highest ? threshold : highest;
   #endif
 }
 
 void Logging::setOutput(Print* output) {
   #ifndef DISABLE_LOGGING
-    _logOutput = output;
+    OutputLock lock;
+    #if LOG_BATCH_SIZE > 0
+      flushBatch();
+    #endif
+    _outputCount = 0;
+    if (output != nullptr) {
+      addOutput(output, LOG_LEVEL_TRACE);
+    }
+    updateEnabledLevel();
+  #endif
+}
+
+bool Logging::addOutput(Print* output, int level) {
+  #ifndef DISABLE_LOGGING
+    OutputLock lock;
+    #if LOG_BATCH_SIZE > 0
+      flushBatch();
+    #endif
+    uint8_t i = 0;
+    while (i < _outputCount && _outputs[i] != output) {
+      ++i;
+    }
+    if (i == _outputCount) {
+      if (_outputCount == LOG_MAX_OUTPUTS)
+        return false;
+      ++_outputCount;
+      // A binary stream must start with the header and formats on the new output too
+      _binaryFormatCount = 0;
+      _binaryNextFormat = 0;
+    }
+    _outputs[i] = output;
+    _outputLevels[i] = level;
+    updateEnabledLevel();
+    return true;
+  #else
+    return false;
+  #endif
+}
+
+void Logging::removeOutput(Print* output) {
+  #ifndef DISABLE_LOGGING
+    OutputLock lock;
+    #if LOG_BATCH_SIZE > 0
+      flushBatch();
+    #endif
+    for (uint8_t i = 0; i < _outputCount; ++i) {
+      if (_outputs[i] == output) {
+        --_outputCount;
+        for (; i < _outputCount; ++i) {
+          _outputs[i] = _outputs[i + 1];
+          _outputLevels[i] = _outputLevels[i + 1];
+        }
+        break;
+      }
+    }
+    updateEnabledLevel();
+  #endif
+}
+
+void Logging::updateEnabledLevel() {
+  #ifndef DISABLE_LOGGING
+    int highest = LOG_LEVEL_SILENT;
+    for (uint8_t i = 0; i < _outputCount; ++i) {
+      if (_outputLevels[i] > highest) {
+        highest = _outputLevels[i];
+      }
+    }
+    _outputLevel = highest;
+
+    for (Logging* log = _instances; log != nullptr; log = log->_next) {
+      log->updateInstanceLevel();
+    }
   #endif
 }
 
 void Logging::setPrefix(const char* format) {
   #ifndef DISABLE_LOGGING
     _prefixFormat = format;
+    _prefixTokenCount = 0;
+    _prefixCompiled = true;
+    if (format == nullptr)
+      return;
+
+    // Literal spans point into the format; "%%" starts a span at its second '%'
+    ArduinoLogFormat::Modifiers modifiers = { -1, 0, false, false };
+    const char* literal = format;
+    for (const char* p = format; ; ++p) {
+      if (*p != 0 && (*p != '%' || *(p + 1) == 0))
+        continue;
+      if (!addPrefixToken(literal, p - literal, 0, modifiers))
+        break;
+      if (*p == 0)
+        break;
+      p = ArduinoLogFormat::parseModifiers(p + 1, modifiers);
+      if (*p == 0)
+        break;
+      literal = p;
+      if (*p != '%') {
+        literal = p + 1;
+        if (!addPrefixToken(nullptr, 0, *p, modifiers))
+          break;
+      }
+    }
+  #endif
+}
+
+// False once the table is full; the prefix is then parsed for every line instead.
+bool Logging::addPrefixToken(const char* text, size_t length, char spec,
+                             const ArduinoLogFormat::Modifiers& modifiers) {
+  #ifndef DISABLE_LOGGING
+    // Long literals take several tokens
+    do {
+      if (spec == 0 && length == 0)
+        return true;
+      if (_prefixTokenCount == LOG_PREFIX_TOKENS) {
+        _prefixCompiled = false;
+        return false;
+      }
+      PrefixToken& token = _prefixTokens[_prefixTokenCount++];
+      token.text = text;
+      token.length = length > 255 ? 255 : (uint8_t) length;
+      token.spec = spec;
+      token.modifiers = modifiers;
+      text += token.length;
+      length -= token.length;
+    } while (spec == 0 && length > 0);
+    return true;
+  #else
+    return false;
   #endif
 }
 
 void Logging::clearPrefix() {
   #ifndef DISABLE_LOGGING
     _prefixFormat = nullptr;
+    _prefixTokenCount = 0;
   #endif
 }
 
@@ -42,9 +321,299 @@ void Logging::setDigit(int digit) {
   #endif
 }
 
-void Logging::println(const __FlashStringHelper *format, va_list args) {
+void Logging::setClock(Clock clock) {
+  #ifndef DISABLE_LOGGING
+    _clock = clock;
+  #endif
+}
+
+bool Logging::admit(LogLimiter& limiter) {
+  #ifndef DISABLE_LOGGING
+    if (limiter.admit(now()))
+      return true;
+    ++_suppressedCount;
+  #endif
+  return false;
+}
+
+uint32_t Logging::getSuppressedCount() {
+  #ifndef DISABLE_LOGGING
+    return _suppressedCount;
+  #else
+    return 0;
+  #endif
+}
+
+bool Logging::sampled(uint32_t threshold) {
+  #ifndef DISABLE_LOGGING
+    // Never zero, so every threshold from 0 (never) to 65535 (always) is reachable
+    uint16_t x = _sampleState;
+    x ^= x << 7;
+    x ^= x >> 9;
+    x ^= x << 8;
+    _sampleState = x;
+    return x <= threshold;
+  #else
+    return false;
+  #endif
+}
+
+void Logging::appendSuppressed(LogLine& out, uint16_t suppressed) {
+  out.append(" (", 2);
+  out.appendDecimal((unsigned long) suppressed);
+  out.append(" suppressed)");
+}
+
+#if LOG_STATISTICS
+  #ifndef DISABLE_LOGGING
+    namespace {
+      // LogStatistics is a plain run of counters, read and cleared one at a time
+      const size_t kStatisticsCounters = sizeof(LogStatistics) / sizeof(uint32_t);
+
+      inline uint32_t* counters(LogStatistics& statistics) {
+        return reinterpret_cast<uint32_t*>(&statistics);
+      }
+    }
+  #endif
+
+  void Logging::getStatistics(LogStatistics& statistics) {
+    #ifndef DISABLE_LOGGING
+      for (size_t i = 0; i < kStatisticsCounters; ++i) {
+        #if LOG_THREAD_SAFE
+          counters(statistics)[i] = __atomic_load_n(&counters(_statistics)[i], __ATOMIC_RELAXED);
+        #else
+          counters(statistics)[i] = counters(_statistics)[i];
+        #endif
+      }
+      #if LOG_ASYNC_BUFFER_SIZE > 0
+        statistics.dropped = _ring.dropped() - _statistics.dropped;
+      #endif
+    #else
+      memset(&statistics, 0, sizeof(statistics));
+    #endif
+  }
+
+  // The ring keeps its own dropped count, so _statistics.dropped holds its value at the reset
+  void Logging::resetStatistics() {
+    #ifndef DISABLE_LOGGING
+      for (size_t i = 0; i < kStatisticsCounters; ++i) {
+        #if LOG_THREAD_SAFE
+          __atomic_store_n(&counters(_statistics)[i], 0, __ATOMIC_RELAXED);
+        #else
+          counters(_statistics)[i] = 0;
+        #endif
+      }
+      #if LOG_ASYNC_BUFFER_SIZE > 0
+        #if LOG_THREAD_SAFE
+          __atomic_store_n(&_statistics.dropped, _ring.dropped(), __ATOMIC_RELAXED);
+        #else
+          _statistics.dropped = _ring.dropped();
+        #endif
+      #endif
+    #endif
+  }
+
+  void Logging::setStatisticsClock(Clock clock) {
+    #ifndef DISABLE_LOGGING
+      _statisticsClock = clock;
+    #endif
+  }
+
+  void Logging::printStatistics(Print& output) {
+    #ifndef DISABLE_LOGGING
+      static const char* const names[] = {
+        LEVEL_ABBREV_CRITICAL, LEVEL_ABBREV_ERROR, LEVEL_ABBREV_WARNING,
+        LEVEL_ABBREV_INFO, LEVEL_ABBREV_DEBUG, LEVEL_ABBREV_TRACE
+      };
+      LogStatistics statistics;
+      getStatistics(statistics);
+
+      LogLine out;
+      out.append("messages");
+      for (int level = LOG_LEVEL_CRITICAL; level <= LOG_LEVEL_TRACE; ++level) {
+        out.append(' ');
+        out.append(names[level - LOG_LEVEL_CRITICAL]);
+        out.append('=');
+        out.appendDecimal((unsigned long) statistics.messages[level]);
+      }
+      out.finish();
+      output.write(reinterpret_cast<const uint8_t*>(out.data()), out.length());
+
+      out.clear();
+      out.append("filtered=");
+      out.appendDecimal((unsigned long) statistics.filtered);
+      out.append(" bytes=");
+      out.appendDecimal((unsigned long) statistics.bytes);
+      out.append(" truncated=");
+      out.appendDecimal((unsigned long) statistics.truncated);
+      out.append(" dropped=");
+      out.appendDecimal((unsigned long) statistics.dropped);
+      out.append(" time=");
+      out.appendDecimal((unsigned long) statistics.totalMicros);
+      out.append("us max=");
+      out.appendDecimal((unsigned long) statistics.maxMicros);
+      out.append("us");
+      out.finish();
+      output.write(reinterpret_cast<const uint8_t*>(out.data()), out.length());
+    #endif
+  }
+
+  #ifndef DISABLE_LOGGING
+    void Logging::countMessage(int level, unsigned long elapsed) {
+      if (level >= 0 && level <= LOG_LEVEL_TRACE) {
+        addStatistic(_statistics.messages[level], 1);
+      }
+      addStatistic(_statistics.totalMicros, elapsed);
+      #if LOG_THREAD_SAFE
+        uint32_t longest = __atomic_load_n(&_statistics.maxMicros, __ATOMIC_RELAXED);
+        while (elapsed > longest &&
+               !__atomic_compare_exchange_n(&_statistics.maxMicros, &longest, (uint32_t) elapsed, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+      #else
+        if (elapsed > _statistics.maxMicros) {
+          _statistics.maxMicros = elapsed;
+        }
+      #endif
+    }
+  #endif
+#endif
+
+void Logging::setBinaryMode(bool enabled) {
+  #ifndef DISABLE_LOGGING
+    RecordLock lock;
+    _binaryMode = enabled;
+    _binaryFormatCount = 0;
+    _binaryNextFormat = 0;
+  #endif
+}
+
+#if LOG_BATCH_SIZE > 0
+  void Logging::setBatching(bool enabled, unsigned long maxAge, int flushLevel) {
+    #ifndef DISABLE_LOGGING
+      OutputLock lock;
+      if (!enabled) {
+        flushBatch();
+      }
+      _batching = enabled;
+      _batchMaxAge = maxAge;
+      _batchFlushLevel = flushLevel;
+    #endif
+  }
+
+  void Logging::flush() {
+    #ifndef DISABLE_LOGGING
+      OutputLock lock;
+      flushBatch();
+    #endif
+  }
+
+  void Logging::flushIfDue() {
+    #ifndef DISABLE_LOGGING
+      OutputLock lock;
+      if (!_batch.empty() && now() - _batch.start() >= _batchMaxAge) {
+        flushBatch();
+      }
+    #endif
+  }
+
+  #ifndef DISABLE_LOGGING
+    // Called with the output lock held. False if the message is larger than the block; the block
+    // is then flushed, so the message can be written after it.
+    bool Logging::batch(const uint8_t* data, size_t size, int level) {
+      unsigned long time = now();
+      if (!_batch.add(level, data, size, time)) {
+        flushBatch();
+        if (!_batch.add(level, data, size, time))
+          return false;
+      }
+      // Binary header and format frames have no level of their own and don't flush
+      if ((level > LOG_LEVEL_SILENT && level <= _batchFlushLevel) || time - _batch.start() >= _batchMaxAge) {
+        flushBatch();
+      }
+      return true;
+    }
+
+    void Logging::flushBatch() {
+      if (!_batch.empty()) {
+        _batch.flush(_outputs, _outputLevels, _outputCount);
+      }
+    }
+  #endif
+#endif
+
+#if LOG_ASYNC_BUFFER_SIZE > 0
+  void Logging::setAsync(bool enabled) {
+    #ifndef DISABLE_LOGGING
+      if (!enabled) {
+        drain();
+      }
+      _async = enabled;
+    #endif
+  }
+
+  void Logging::setOverflowPolicy(uint8_t policy) {
+    #ifndef DISABLE_LOGGING
+      #if defined(__AVR__) || defined(ESP8266)
+        // The drain runs from loop() like the log calls, so a full buffer would never empty
+        if (policy == LOG_OVERFLOW_BLOCK) {
+          policy = LOG_OVERFLOW_DROP_NEWEST;
+        }
+      #endif
+      _overflowPolicy = policy;
+    #endif
+  }
+
+  size_t Logging::drain() {
+    size_t count = 0;
+    #ifndef DISABLE_LOGGING
+      // Only the drain takes from the ring, so one buffer serves every call
+      static uint8_t message[LOG_LINE_BUFFER_SIZE > LOG_BINARY_RECORD_SIZE ? LOG_LINE_BUFFER_SIZE : LOG_BINARY_RECORD_SIZE];
+      #if LOG_THREAD_SAFE
+        static std::mutex drainMutex;
+        std::lock_guard<std::mutex> draining(drainMutex);
+      #endif
+      uint8_t level;
+      size_t size = sizeof(message);
+      // Taking a message needs no lock, only the write to the outputs does. A producer blocked on
+      // a full buffer may hold RecordLock, never OutputLock.
+      while (_ring.pop(level, message, size)) {
+        {
+          OutputLock lock;
+          dispatch(message, size, level);
+        }
+        size = sizeof(message);
+        ++count;
+      }
+    #endif
+    return count;
+  }
+
+  uint32_t Logging::getDroppedCount() {
+    #ifndef DISABLE_LOGGING
+      return _ring.dropped();
+    #else
+      return 0;
+    #endif
+  }
+
+  #ifdef ESP32
+    static void drainTask(void*) {
+      for (;;) {
+        Logging::drain();
+        vTaskDelay(1);
+      }
+    }
+
+    bool Logging::startDrainTask(uint32_t stackSize, UBaseType_t priority, BaseType_t core) {
+      return xTaskCreatePinnedToCore(drainTask, "ArduinoLog", stackSize, nullptr, priority, nullptr, core) == pdPASS;
+    }
+  #endif
+#endif
+
+void Logging::println(LogLine& out, const __FlashStringHelper *format, va_list args) {
   #ifndef DISABLE_LOGGING
     PGM_P p = reinterpret_cast<PGM_P>(format);
+    ArduinoLogFormat::Modifiers modifiers;
     // This copy is only necessary on some architectures (x86) to change a passed
     // array in to a va_list.
     #ifdef __x86_64__
@@ -52,30 +621,191 @@ void Logging::println(const __FlashStringHelper *format, va_list args) {
       va_copy(args_copy, args);
     #endif
 
-    char c = pgm_read_byte(p++);
-    for(;c != 0; c = pgm_read_byte(p++)) {
-      if (c == '%') {
-        c = pgm_read_byte(p++);
+    // Literal runs are copied in bulk, the format is only read byte by byte at a '%'
+    PGM_P end = p + strlen_P(p);
+    while (p < end) {
+      p += out.appendFlashUntil(p, end - p, '%');
+      if (p == end)
+        break;
+      p = ArduinoLogFormat::parseFlashModifiers(p + 1, modifiers);
+      if (p == end)
+        break;
+      char c = pgm_read_byte(p++);
 
-        #ifdef __x86_64__
-          printFormat(c, &args_copy);
-        #else
-          printFormat(c, &args);
-        #endif
-      } else {
-        _logOutput->print(c);
-      }
+      size_t start = out.length();
+      #ifdef __x86_64__
+        printFormat(out, c, &args_copy, modifiers.precision);
+      #else
+        printFormat(out, c, &args, modifiers.precision);
+      #endif
+      ArduinoLogFormat::applyModifiers(out, start, c, modifiers);
     }
 
-    _logOutput->println();
     #ifdef __x86_64__
       va_end(args_copy);
     #endif
   #endif
 }
 
-void Logging::println(const char *format, va_list args) {
+void Logging::printLevel(int level, const char* msg, ...) {
+  #ifndef DISABLE_LOGGING
+    va_list args;
+    va_start(args, msg);
+    printMessage(level, msg, args);
+    va_end(args);
+  #endif
+}
+
+void Logging::printLevel(int level, const __FlashStringHelper* msg, ...) {
+  #ifndef DISABLE_LOGGING
+    va_list args;
+    va_start(args, msg);
+    printMessage(level, msg, args);
+    va_end(args);
+  #endif
+}
+
+void Logging::printLevel(int level, const Printable& obj) {
+  #ifndef DISABLE_LOGGING
+    printObject(level, &obj);
+  #endif
+}
+
+// A printable has no arguments, but the renderers all take a va_list, and va_start needs a last
+// parameter that is not a reference
+void Logging::printObject(int level, const Printable* obj, ...) {
+  #ifndef DISABLE_LOGGING
+    va_list args;
+    va_start(args, obj);
+    printMessage<const Printable&>(level, *obj, args);
+    va_end(args);
+  #endif
+}
+
+template <class T>
+void Logging::printMessage(int level, T msg, va_list args) {
+  #ifndef DISABLE_LOGGING
+    #if LOG_STATISTICS
+      StatisticsScope statistics(level);
+    #endif
+
+    #if LOG_FLIGHT_RECORDER
+      // Recorded first, so the record exists even if writing the output never returns
+      if (level <= _recorderLevel) {
+        va_list recorded;
+        va_copy(recorded, args);
+        recordFlight(level, msg, recorded);
+        va_end(recorded);
+      }
+      if (level > _outputLevel)
+        return;
+    #endif
+
+    if (_binaryMode) {
+      printBinary(level, msg, args);
+    } else {
+      LogLine line(level);
+      printPrefixFormat(line);
+      println(line, msg, args);
+      writeLine(line, level);
+    }
+  #endif
+}
+
+void Logging::printCompiledLine(int level, uint16_t suppressed, const char* format, LineEmitter line,
+                                RecordEmitter record, const void* const* args) {
   #ifndef DISABLE_LOGGING
+    #if LOG_STATISTICS
+      StatisticsScope statistics(level);
+    #endif
+
+    #if LOG_FLIGHT_RECORDER
+      if (level <= _recorderLevel) {
+        RecordLock lock;
+        beginFlightRecord(level, format, LOG_FORMAT_WIDE_INTEGERS);
+        record(*this, _record, args);
+        endFlightRecord();
+      }
+      if (level > _outputLevel)
+        return;
+    #endif
+
+    // Binary records have no room for the suppressed count, getSuppressedCount() still has it.
+    if (_binaryMode) {
+      RecordLock lock;
+      if (beginRecord(level, format, false, LOG_FORMAT_WIDE_INTEGERS)) {
+        record(*this, _record, args);
+        writeRecord(_record, level);
+      }
+      return;
+    }
+
+    LogLine out(level);
+    printPrefixFormat(out);
+    line(*this, out, args);
+    if (suppressed > 0) {
+      appendSuppressed(out, suppressed);
+    }
+    writeLine(out, level);
+  #endif
+}
+
+#ifndef DISABLE_LOGGING
+
+namespace {
+
+  // Lines of Logging::hexdump() go through printCompiledLine(), and their records carry this format
+  const char kHexdumpFormat[] = "%X: %h";
+
+  struct HexdumpLine {
+    unsigned long offset;
+    const uint8_t* data;
+    size_t size;
+    bool ascii;
+  };
+
+  void printHexdumpLine(Logging&, LogLine& out, const void* const* args) {
+    const HexdumpLine& line = *static_cast<const HexdumpLine*>(args[0]);
+    ArduinoLogFormat::printHexPrefixed(out, line.offset);
+    out.append(": ", 2);
+    out.appendHexBytes(line.data, line.size);
+    if (line.ascii) {
+      // A short last line is padded, so its text lines up with the lines above
+      out.appendFill(' ', 3 * (LOG_HEXDUMP_WIDTH - line.size) + 2);
+      out.appendAscii(line.data, line.size);
+    }
+  }
+
+  // Integers of printCompiledLine() records are a long
+  void encodeHexdumpLine(Logging&, LogRecord& out, const void* const* args) {
+    const HexdumpLine& line = *static_cast<const HexdumpLine*>(args[0]);
+    out.put(&line.offset, sizeof(line.offset));
+    out.putBytes(line.data, line.size);
+  }
+
+}
+
+#endif
+
+void Logging::hexdump(int level, const void* data, size_t size, bool ascii) {
+  #ifndef DISABLE_LOGGING
+    if (data == nullptr || !shouldLog(level))
+      return;
+
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for (size_t offset = 0; offset < size; offset += LOG_HEXDUMP_WIDTH) {
+      HexdumpLine line = {
+        offset, bytes + offset, size - offset < LOG_HEXDUMP_WIDTH ? size - offset : LOG_HEXDUMP_WIDTH, ascii
+      };
+      const void* const args[] = { &line };
+      printCompiledLine(level, 0, kHexdumpFormat, printHexdumpLine, encodeHexdumpLine, args);
+    }
+  #endif
+}
+
+void Logging::println(LogLine& out, const char *format, va_list args) {
+  #ifndef DISABLE_LOGGING
+    ArduinoLogFormat::Modifiers modifiers;
     // This copy is only necessary on some architectures (x86) to change a passed
     // array in to a va_list.
     #ifdef __x86_64__
@@ -85,132 +815,219 @@ void Logging::println(const char *format, va_list args) {
 
     for (; *format != 0; ++format) {
       if (*format == '%') {
-        ++format;
+        format = ArduinoLogFormat::parseModifiers(format + 1, modifiers);
+        if (*format == 0)
+          break;
+        size_t start = out.length();
         #ifdef __x86_64__
-          printFormat(*format, &args_copy);
+          printFormat(out, *format, &args_copy, modifiers.precision);
         #else
-          printFormat(*format, &args);
+          printFormat(out, *format, &args, modifiers.precision);
         #endif
+        ArduinoLogFormat::applyModifiers(out, start, *format, modifiers);
       } else {
-        _logOutput->print(*format);
+        out.append(*format);
       }
     }
 
-    _logOutput->println();
     #ifdef __x86_64__
       va_end(args_copy);
     #endif
   #endif
 }
 
-void Logging::printFormat(const char format, va_list *args) {
+void Logging::printFormat(LogLine& out, const char format, va_list *args, int precision) {
   #ifndef DISABLE_LOGGING
     if (format == '\0')
       return;
     if (format == '%') {
-      _logOutput->print(format);
+      out.append(format);
     }
 
     else if (format == 's') {
-      char *s = va_arg(*args, char *);
-      _logOutput->print(s);
+      ArduinoLogFormat::printString(out, va_arg(*args, char *));
     }
     else if (format == 'S') {
-      __FlashStringHelper *s = va_arg(*args, __FlashStringHelper *);
-      _logOutput->print(s);
+      ArduinoLogFormat::printFlashString(out, va_arg(*args, __FlashStringHelper *));
     }
 
     else if (format == 'd') {
-      _logOutput->print(va_arg(*args, int), DEC);
+      ArduinoLogFormat::printDecimal(out, (long) va_arg(*args, int));
     }
-    else if (format == 'f') {
-      _logOutput->print(va_arg(*args, double), _digit);
+    else if (format == 'f' || format == 'D' || format == 'F') {
+      ArduinoLogFormat::printFloat(out, va_arg(*args, double), precision >= 0 ? precision : _digit);
     }
 
     else if (format == 'x') {
-      _logOutput->print(va_arg(*args, int), HEX);
+      ArduinoLogFormat::printHex(out, (unsigned long) (unsigned int) va_arg(*args, int));
     }
     else if (format == 'X') {
-      _logOutput->print("0x");
-      //_logOutput->print(va_arg(*args, int), HEX);
-      uint16_t h = (uint16_t) va_arg(*args, int);
-      if (h < 0xFFF) _logOutput->print('0');
-      if (h < 0xFF) _logOutput->print('0');
-      if (h < 0xF) _logOutput->print('0');
-      _logOutput->print(h, HEX);
+      ArduinoLogFormat::printHexPrefixed(out, (unsigned long) (unsigned int) va_arg(*args, int));
     }
 
     else if (format == 'p') {
-      Printable *obj = (Printable *) va_arg(*args, int);
-      _logOutput->print(*obj);
+      ArduinoLogFormat::printPrintable(out, va_arg(*args, Printable *));
+    }
+    else if (format == 'h') {
+      const void* data = va_arg(*args, const void *);
+      ArduinoLogFormat::printHexBytes(out, data, ArduinoLogFormat::byteCount(va_arg(*args, int)));
     }
 
     else if (format == 'b') {
-      _logOutput->print(va_arg(*args, int), BIN);
+      ArduinoLogFormat::printBinary(out, (unsigned long) (unsigned int) va_arg(*args, int));
     }
     else if (format == 'B') {
-      _logOutput->print("0b");
-      _logOutput->print(va_arg(*args, int), BIN);
+      ArduinoLogFormat::printBinaryPrefixed(out, (unsigned long) (unsigned int) va_arg(*args, int));
     }
 
     else if (format == 'l') {
-      _logOutput->print(va_arg(*args, long), DEC);
+      ArduinoLogFormat::printDecimal(out, va_arg(*args, long));
     }
     else if (format == 'u') {
-      _logOutput->print(va_arg(*args, unsigned long), DEC);
+      ArduinoLogFormat::printDecimal(out, va_arg(*args, unsigned long));
     }
 
     else if (format == 'c') {
-      _logOutput->print((char) va_arg(*args, int));
+      ArduinoLogFormat::printChar(out, (char) va_arg(*args, int));
     }
     else if (format == 'C') {
-      char c = (char) va_arg(*args, int);
-      if (c >= 0x20 && c < 0x7F) {
-        _logOutput->print(c);
-      } else {
-        _logOutput->print("0x");
-        if (c < 0xF) _logOutput->print('0');
-        _logOutput->print(c, HEX);
-      }
+      ArduinoLogFormat::printCharOrHex(out, (char) va_arg(*args, int));
     }
 
     else if (format == 't') {
-      if (va_arg(*args, int) == 1) {
-        _logOutput->print("T");
-      }
-      else {
-        _logOutput->print("F");
-      }
+      ArduinoLogFormat::printBool(out, va_arg(*args, int) == 1);
     }
     else if (format == 'T') {
-      if (va_arg(*args, int) == 1) {
-        _logOutput->print(F("true"));
-      }
-      else {
-        _logOutput->print(F("false"));
-      }
+      ArduinoLogFormat::printBoolWord(out, va_arg(*args, int) == 1);
     }
 
     // Internal variables - don't consume va_arg
-    else if (format == 'L' || format == 'v' || format == 'n') {
-      printInternal(format);
+    else if (format == 'L' || format == 'v' || format == 'n' || format == 'm' || format == 'M' || format == 'r') {
+      printInternal(out, format);
+    }
+
+    else if (_legacyLine != &out) {
+      // An override of the former printFormat(char, va_list*) writes to _logOutput
+      LogLine* previous = _legacyLine;
+      _legacyLine = &out;
+      #pragma GCC diagnostic push
+      #pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+      printFormat(format, args);
+      #pragma GCC diagnostic pop
+      _legacyLine = previous;
     }
   #endif
 }
 
-void Logging::printInternal(char format) {
+// Renders into the line of the printFormat(LogLine&, ...) call it comes from, or on its own
+// straight to _logOutput as it used to
+void Logging::printFormat(const char format, va_list *args) {
+  #ifndef DISABLE_LOGGING
+    if (_legacyLine != nullptr) {
+      printFormat(*_legacyLine, format, args);
+    } else if (Print* output = _logOutput) {
+      LogLine line;
+      printFormat(line, format, args);
+      output->write(reinterpret_cast<const uint8_t*>(line.data()), line.length());
+    }
+  #endif
+}
+
+void Logging::printInternal(LogLine& out, char format) {
   #ifndef DISABLE_LOGGING
     if (format == 'L') {
-      _logOutput->print(getLevelAbbrev(_currentLevel));
+      out.append(getLevelAbbrev(out.level()));
     }
     else if (format == 'v') {
-      _logOutput->print(getLevelAbbrev(_level));
+      out.append(getLevelAbbrev(getLevel()));
     }
     else if (format == 'n') {
       if (_moduleName != NULL) {
-        _logOutput->print(_moduleName);
+        out.append(_moduleName);
+      }
+    }
+    else if (format == 'm' || format == 'M') {
+      if (!out.hasTime()) {
+        out.setTime(now());
+      }
+      if (format == 'm') {
+        out.appendDecimal(out.time());
+      } else {
+        #if LOG_THREAD_SAFE
+          // The shared timestamp only pays off when one thread updates it
+          LogTimestamp timestamp;
+        #else
+          LogTimestamp& timestamp = _timestamp;
+        #endif
+        timestamp.update(out.time());
+        out.append(timestamp.text(), timestamp.length());
       }
     }
+    else if (format == 'r') {
+      out.appendDecimal(freeMemory());
+    }
+    else if (_legacyLine != &out) {
+      // An override of the former printInternal(char) writes to _logOutput
+      LogLine* previous = _legacyLine;
+      _legacyLine = &out;
+      #pragma GCC diagnostic push
+      #pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+      printInternal(format);
+      #pragma GCC diagnostic pop
+      _legacyLine = previous;
+    }
+  #endif
+}
+
+// Renders into the line of the printInternal(LogLine&, char) call it comes from, or on its own
+// straight to _logOutput as it used to
+void Logging::printInternal(char format) {
+  #ifndef DISABLE_LOGGING
+    if (_legacyLine != nullptr) {
+      printInternal(*_legacyLine, format);
+    } else if (Print* output = _logOutput) {
+      LogLine line;
+      printInternal(line, format);
+      output->write(reinterpret_cast<const uint8_t*>(line.data()), line.length());
+    }
+  #endif
+}
+
+Print* Logging::LegacyOutput::get() const {
+  #ifndef DISABLE_LOGGING
+    if (_legacyLine != nullptr)
+      return _legacyLine;
+    return _outputCount > 0 ? _outputs[0] : nullptr;
+  #else
+    return nullptr;
+  #endif
+}
+
+#ifndef DISABLE_LOGGING
+  #if defined(__AVR__)
+    extern char __heap_start;
+    extern char* __brkval;
+  #elif defined(__arm__) && !defined(ESP32) && !defined(ESP8266)
+    extern "C" char* sbrk(int increment);
+  #endif
+#endif
+
+// Free heap where the core reports it, else the gap between the top of the heap and the stack
+unsigned long Logging::freeMemory() {
+  #ifndef DISABLE_LOGGING
+    #if defined(ESP32) || defined(ESP8266)
+      return ESP.getFreeHeap();
+    #elif defined(__AVR__)
+      char top;
+      return &top - (__brkval != nullptr ? __brkval : &__heap_start);
+    #elif defined(__arm__)
+      char top;
+      return &top - sbrk(0);
+    #else
+      return 0;
+    #endif
+  #else
+    return 0;
   #endif
 }
 
@@ -230,18 +1047,529 @@ const char* Logging::getLevelAbbrev(int level) {
   #endif
 }
 
-void Logging::printPrefixFormat() {
+void Logging::printPrefixFormat(LogLine& out) {
   #ifndef DISABLE_LOGGING
     if (_prefixFormat == nullptr)
       return;
 
+    if (_prefixCompiled) {
+      for (uint8_t i = 0; i < _prefixTokenCount; ++i) {
+        const PrefixToken& token = _prefixTokens[i];
+        if (token.spec == 0) {
+          out.append(token.text, token.length);
+        } else {
+          size_t start = out.length();
+          printInternal(out, token.spec);
+          ArduinoLogFormat::applyModifiers(out, start, token.spec, token.modifiers);
+        }
+      }
+      return;
+    }
+
+    ArduinoLogFormat::Modifiers modifiers;
     for (const char* p = _prefixFormat; *p != 0; ++p) {
       if (*p == '%' && *(p + 1) != 0) {
-        ++p;
-        printInternal(*p);
+        p = ArduinoLogFormat::parseModifiers(p + 1, modifiers);
+        if (*p == 0)
+          break;
+        if (*p == '%') {
+          out.append(*p);
+        } else {
+          size_t start = out.length();
+          printInternal(out, *p);
+          ArduinoLogFormat::applyModifiers(out, start, *p, modifiers);
+        }
       } else {
-        _logOutput->print(*p);
+        out.append(*p);
+      }
+    }
+  #endif
+}
+
+void Logging::writeLine(LogLine& out, int level) {
+  #ifndef DISABLE_LOGGING
+    out.finish();
+    #if LOG_STATISTICS
+      if (out.truncated()) {
+        addStatistic(_statistics.truncated, 1);
+      }
+    #endif
+    writeOutput(reinterpret_cast<const uint8_t*>(out.data()), out.length(), level);
+  #endif
+}
+
+// Takes the output lock only to write to the outputs; the asynchronous buffer takes concurrent
+// pushes by itself. False if the asynchronous buffer dropped the message.
+bool Logging::writeOutput(const uint8_t* data, size_t size, int level) {
+  #ifndef DISABLE_LOGGING
+    #if LOG_ASYNC_BUFFER_SIZE > 0
+      if (_async) {
+        return _ring.push(level, data, size, _overflowPolicy);
+      }
+    #endif
+    OutputLock lock;
+    dispatch(data, size, level);
+  #endif
+  return true;
+}
+
+// Binary header and format frames are written with LOG_LEVEL_SILENT and so reach every output.
+// Counts the bytes here, so a message the asynchronous buffer dropped is not counted as written.
+void Logging::dispatch(const uint8_t* data, size_t size, int level) {
+  #ifndef DISABLE_LOGGING
+    #if LOG_STATISTICS
+      addStatistic(_statistics.bytes, size);
+    #endif
+    #if LOG_BATCH_SIZE > 0
+      if (_batching && batch(data, size, level))
+        return;
+    #endif
+    for (uint8_t i = 0; i < _outputCount; ++i) {
+      if (level <= _outputLevels[i]) {
+        _outputs[i]->write(data, size);
       }
     }
   #endif
 }
+
+size_t LogLine::write(uint8_t c) {
+  if (_length >= kCapacity) {
+    _truncated = true;
+    return 0;
+  }
+  _buffer[_length++] = (char) c;
+  return 1;
+}
+
+size_t LogLine::write(const uint8_t* buffer, size_t size) {
+  size_t room = kCapacity - _length;
+  if (size > room) {
+    size = room;
+    _truncated = true;
+  }
+  memcpy(_buffer + _length, buffer, size);
+  _length += size;
+  return size;
+}
+
+void LogLine::append(char c) {
+  write((uint8_t) c);
+}
+
+void LogLine::append(const char* str) {
+  if (str != nullptr) {
+    append(str, strlen(str));
+  }
+}
+
+void LogLine::append(const char* str, size_t size) {
+  write(reinterpret_cast<const uint8_t*>(str), size);
+}
+
+void LogLine::appendFlash(const __FlashStringHelper* str) {
+  if (str == nullptr)
+    return;
+
+  PGM_P p = reinterpret_cast<PGM_P>(str);
+  appendFlash(p, strlen_P(p));
+}
+
+void LogLine::appendFlash(PGM_P str, size_t size) {
+  size_t room = kCapacity - _length;
+  if (size > room) {
+    size = room;
+    _truncated = true;
+  }
+  memcpy_P(_buffer + _length, str, size);
+  _length += size;
+}
+
+size_t LogLine::appendFlashUntil(PGM_P str, size_t size, char stop) {
+  size_t done = 0;
+  while (done < size) {
+    size_t chunk = size - done < kFlashChunk ? size - done : kFlashChunk;
+    size_t room = kCapacity - _length;
+    size_t copied = chunk < room ? chunk : room;
+    memcpy_P(_buffer + _length, str + done, copied);
+
+    const char* found = static_cast<const char*>(memchr(_buffer + _length, stop, copied));
+    if (found != nullptr) {
+      size_t run = found - (_buffer + _length);
+      _length += run;
+      return done + run;
+    }
+    _length += copied;
+    done += copied;
+    if (copied < chunk) {
+      // Nothing after this fits the line, so the rest of the text needs no scan
+      _truncated = true;
+      return size;
+    }
+  }
+  return size;
+}
+
+// "00" "01" ... "99", so decimal conversion takes one division per two digits
+static const char kDigitPairs[] PROGMEM =
+  "0001020304050607080910111213141516171819"
+  "2021222324252627282930313233343536373839"
+  "4041424344454647484950515253545556575859"
+  "6061626364656667686970717273747576777879"
+  "8081828384858687888990919293949596979899";
+
+static const char kHexDigits[] PROGMEM = "0123456789ABCDEF";
+
+// Writes the decimal digits of value backwards, ending at end, and returns the first digit
+static char* formatDecimal(char* end, unsigned long value) {
+  char* p = end;
+  while (value >= 100) {
+    unsigned long quotient = value / 100;
+    uint8_t pair = (uint8_t) (value - quotient * 100) * 2;
+    *--p = pgm_read_byte(kDigitPairs + pair + 1);
+    *--p = pgm_read_byte(kDigitPairs + pair);
+    value = quotient;
+  }
+  if (value >= 10) {
+    uint8_t pair = (uint8_t) value * 2;
+    *--p = pgm_read_byte(kDigitPairs + pair + 1);
+    *--p = pgm_read_byte(kDigitPairs + pair);
+  } else {
+    *--p = (char) ('0' + value);
+  }
+  return p;
+}
+
+void LogLine::appendDecimal(unsigned long value) {
+  char digits[3 * sizeof(unsigned long)];
+  char* end = digits + sizeof(digits);
+  char* p = formatDecimal(end, value);
+  append(p, end - p);
+}
+
+void LogLine::appendDecimal(unsigned long long value) {
+  if (value <= ULONG_MAX) {
+    appendDecimal((unsigned long) value);
+    return;
+  }
+
+  // Only where long is narrower: split into groups of nine digits, so the slow wide division
+  // runs at most twice and the rest uses long arithmetic
+  char digits[20];
+  char* end = digits + sizeof(digits);
+  char* p = end;
+  while (value > ULONG_MAX) {
+    unsigned long group = (unsigned long) (value % 1000000000UL);
+    value /= 1000000000UL;
+    char* start = formatDecimal(p, group);
+    while (start > p - 9) {
+      *--start = '0';
+    }
+    p = start;
+  }
+  p = formatDecimal(p, (unsigned long) value);
+  append(p, end - p);
+}
+
+void LogLine::appendDecimal(long value) {
+  if (value < 0) {
+    append('-');
+    appendDecimal(0UL - (unsigned long) value);
+  } else {
+    appendDecimal((unsigned long) value);
+  }
+}
+
+void LogLine::appendDecimal(long long value) {
+  if (value < 0) {
+    append('-');
+    appendDecimal(0ULL - (unsigned long long) value);
+  } else {
+    appendDecimal((unsigned long long) value);
+  }
+}
+
+void LogLine::appendHex(unsigned long value, uint8_t minDigits) {
+  char digits[2 * sizeof(unsigned long)];
+  char* end = digits + sizeof(digits);
+  char* p = end;
+  do {
+    uint8_t byte = (uint8_t) value;
+    *--p = pgm_read_byte(kHexDigits + (byte & 0xF));
+    *--p = pgm_read_byte(kHexDigits + (byte >> 4));
+    value >>= 8;
+  } while (value != 0);
+
+  if (minDigits > sizeof(digits)) {
+    minDigits = sizeof(digits);
+  }
+  while (p < end - 1 && *p == '0' && end - p > minDigits) {
+    ++p;
+  }
+  while (end - p < minDigits) {
+    *--p = '0';
+  }
+  append(p, end - p);
+}
+
+void LogLine::appendHex(unsigned long long value, uint8_t minDigits) {
+  if (value <= ULONG_MAX && minDigits <= 2 * sizeof(unsigned long)) {
+    appendHex((unsigned long) value, minDigits);
+    return;
+  }
+  // Only where long is 32 bits wide
+  appendHex((unsigned long) (value >> 32), minDigits > 8 ? minDigits - 8 : 1);
+  appendHex((unsigned long) (value & 0xFFFFFFFFUL), 8);
+}
+
+void LogLine::appendBinary(unsigned long value) {
+  char digits[8 * sizeof(unsigned long)];
+  char* end = digits + sizeof(digits);
+  char* p = end;
+  do {
+    uint8_t byte = (uint8_t) value;
+    for (uint8_t bit = 0; bit < 8; ++bit) {
+      *--p = (char) ('0' + (byte & 1));
+      byte >>= 1;
+    }
+    value >>= 8;
+  } while (value != 0);
+
+  while (p < end - 1 && *p == '0') {
+    ++p;
+  }
+  append(p, end - p);
+}
+
+void LogLine::appendBinary(unsigned long long value) {
+  if (value <= ULONG_MAX) {
+    appendBinary((unsigned long) value);
+    return;
+  }
+  // Only where long is 32 bits wide
+  appendBinary((unsigned long) (value >> 32));
+  unsigned long low = (unsigned long) (value & 0xFFFFFFFFUL);
+  for (int8_t bit = 31; bit >= 0; --bit) {
+    append((char) ('0' + ((low >> bit) & 1)));
+  }
+}
+
+// Written straight into the buffer from the nibble table, stopping at the last byte that fits
+void LogLine::appendHexBytes(const uint8_t* data, size_t size, char separator) {
+  if (data == nullptr)
+    return;
+
+  char* p = _buffer + _length;
+  char* end = _buffer + kCapacity;
+  for (size_t i = 0; i < size; ++i) {
+    size_t width = (i > 0 && separator != 0) ? 3 : 2;
+    if ((size_t) (end - p) < width) {
+      _truncated = true;
+      break;
+    }
+    if (width == 3) {
+      *p++ = separator;
+    }
+    *p++ = pgm_read_byte(kHexDigits + (data[i] >> 4));
+    *p++ = pgm_read_byte(kHexDigits + (data[i] & 0xF));
+  }
+  _length = p - _buffer;
+}
+
+void LogLine::appendAscii(const uint8_t* data, size_t size) {
+  if (data == nullptr)
+    return;
+
+  size_t room = kCapacity - _length;
+  if (size > room) {
+    size = room;
+    _truncated = true;
+  }
+  for (size_t i = 0; i < size; ++i) {
+    _buffer[_length++] = (data[i] >= 0x20 && data[i] < 0x7F) ? (char) data[i] : '.';
+  }
+}
+
+void LogLine::appendFill(char c, size_t count) {
+  size_t room = kCapacity - _length;
+  if (count > room) {
+    count = room;
+    _truncated = true;
+  }
+  memset(_buffer + _length, c, count);
+  _length += count;
+}
+
+void LogLine::insertFill(size_t at, char c, size_t count) {
+  if (at > _length) at = _length;
+  size_t room = kCapacity - at;
+  size_t tail = _length - at;
+  if (count + tail > room) {
+    _truncated = true;
+    if (count > room) count = room;
+    tail = room - count;
+  }
+  memmove(_buffer + at + count, _buffer + at, tail);
+  memset(_buffer + at, c, count);
+  _length = at + count + tail;
+}
+
+// The fraction is scaled to an integer once and rounded there, instead of taking one digit per
+// floating point multiplication. A rounding carry moves into the integer part.
+void LogLine::appendFloat(double value, uint8_t digits) {
+  if (isnan(value)) { append("nan", 3); return; }
+  if (isinf(value)) { append(value < 0.0 ? "-inf" : "inf"); return; }
+  if (value > 4294967040.0 || value < -4294967040.0) { append("ovf", 3); return; }
+
+  if (value < 0.0) {
+    append('-');
+    value = -value;
+  }
+
+  if (digits > kMaxFloatDigits) {
+    digits = kMaxFloatDigits;
+  }
+  unsigned long scale = 1;
+  for (uint8_t i = 0; i < digits; ++i) {
+    scale *= 10;
+  }
+
+  unsigned long integer = (unsigned long) value;
+  unsigned long fraction = (unsigned long) ((value - (double) integer) * scale + 0.5);
+  if (fraction >= scale) {
+    fraction -= scale;
+    ++integer;
+  }
+  appendDecimal(integer);
+
+  if (digits > 0) {
+    char text[1 + kMaxFloatDigits];
+    char* end = text + sizeof(text);
+    char* p = formatDecimal(end, fraction);
+    while (p > end - digits) {
+      *--p = '0';
+    }
+    *--p = '.';
+    append(p, end - p);
+  }
+}
+
+// Token bucket of burst messages, refilled by one per interval
+bool LogLimiter::admit(unsigned long now) {
+  if (_interval == 0)
+    return true;
+
+  // Refill one token per whole interval, keeping the rest of the interval for the next call
+  unsigned long elapsed = now - _last;
+  if (_tokens < _burst && elapsed >= _interval) {
+    unsigned long refill = elapsed / _interval;
+    if (refill >= (unsigned long) (_burst - _tokens)) {
+      _tokens = _burst;
+    } else {
+      _tokens += (uint8_t) refill;
+      _last += refill * _interval;
+    }
+  }
+
+  if (_tokens == 0) {
+    if (_suppressed < 0xFFFF) {
+      ++_suppressed;
+    }
+    return false;
+  }
+  // The interval of a full bucket starts with the message that takes from it
+  if (_tokens == _burst) {
+    _last = now;
+  }
+  --_tokens;
+  return true;
+}
+
+// Two digits from the pair table
+static void writePair(char* at, uint8_t value) {
+  at[0] = pgm_read_byte(kDigitPairs + 2 * value);
+  at[1] = pgm_read_byte(kDigitPairs + 2 * value + 1);
+}
+
+// Three digits of a value below 1000
+static void writeMillis(char* at, uint16_t value) {
+  char hundreds = '0';
+  while (value >= 100) {
+    value -= 100;
+    ++hundreds;
+  }
+  at[0] = hundreds;
+  writePair(at + 1, (uint8_t) value);
+}
+
+void LogTimestamp::update(unsigned long time) {
+  unsigned long step = time - _time;
+  if (!_valid || time < _time || step >= kFullUpdate) {
+    _time = time;
+    _hours = time / 3600000UL;
+    time -= _hours * 3600000UL;
+    _minutes = (uint8_t) (time / 60000UL);
+    time -= _minutes * 60000UL;
+    _seconds = (uint8_t) (time / 1000);
+    _millis = (uint16_t) (time - _seconds * 1000UL);
+    _valid = true;
+    render();
+    return;
+  }
+  if (step == 0)
+    return;
+
+  _time = time;
+  _millis += (uint16_t) step;
+  uint8_t seconds = _seconds;
+  while (_millis >= 1000) {
+    _millis -= 1000;
+    ++_seconds;
+  }
+
+  // Milliseconds always change; the other fields, counted from the end of the text, only if they did
+  writeMillis(_text + _length - 3, _millis);
+  if (_seconds == seconds)
+    return;
+
+  if (_seconds >= 60) {
+    _seconds -= 60;
+    if (++_minutes >= 60) {
+      _minutes = 0;
+      ++_hours;
+      render();
+      return;
+    }
+    writePair(_text + _length - 9, _minutes);
+  }
+  writePair(_text + _length - 6, _seconds);
+}
+
+void LogTimestamp::render() {
+  char* end = _text + sizeof(_text) - sizeof(":MM:SS.mmm") + 1;
+  char* p = formatDecimal(end, _hours);
+  if (end - p < 2) {
+    *--p = '0';
+  }
+  _length = (uint8_t) (end - p);
+  memmove(_text, p, _length);
+
+  char* field = _text + _length;
+  field[0] = ':';
+  writePair(field + 1, _minutes);
+  field[3] = ':';
+  writePair(field + 4, _seconds);
+  field[6] = '.';
+  writeMillis(field + 7, _millis);
+  field[10] = 0;
+  _length += 10;
+}
+
+void LogLine::finish() {
+  if (_truncated) {
+    const size_t markLength = sizeof(LOG_TRUNCATION_MARK) - 1;
+    size_t at = _length < markLength ? 0 : _length - markLength;
+    memcpy(_buffer + at, LOG_TRUNCATION_MARK, _length - at);
+  }
+  memcpy(_buffer + _length, LOG_EOL, kEolLength);
+  _length += kEolLength;
+}
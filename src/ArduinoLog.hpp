@@ -2,8 +2,26 @@
 #include "Arduino.h"
 
 #include <inttypes.h>
+#include <limits.h>
 #include <stdarg.h>
 
+// 1 allows logging from several threads or FreeRTOS tasks at once (ESP32, native). Each message is
+// formatted in storage of its own call, and only writing the finished line takes a mutex, so lines
+// never interleave on an output. Binary and flight records share their format table and buffer, and
+// are encoded under the mutex. A log call then must not come from an ISR.
+#ifndef LOG_THREAD_SAFE
+  #define LOG_THREAD_SAFE 0
+#endif
+
+#if LOG_THREAD_SAFE
+  #include <mutex>
+#endif
+
+#include "ArduinoLogBatch.hpp"
+#include "ArduinoLogBinary.hpp"
+#include "ArduinoLogFlightRecorder.hpp"
+#include "ArduinoLogRing.hpp"
+
 // *************************************************************************
 //  Uncomment line below to fully disable logging, and reduce project size
 // ************************************************************************
@@ -17,6 +35,21 @@
 #define LOG_LEVEL_DEBUG    5
 #define LOG_LEVEL_TRACE    6
 
+// Module level that follows Logging::setLevel()
+#define LOG_LEVEL_INHERIT  -1
+
+// *************************************************************************
+//  Highest level compiled in. Log calls above it compile to nothing, e.g.
+//  build with -DLOG_LEVEL_MAX=LOG_LEVEL_WARNING to drop info, debug and trace
+// ************************************************************************
+#ifndef LOG_LEVEL_MAX
+  #ifdef DISABLE_LOGGING
+    #define LOG_LEVEL_MAX LOG_LEVEL_SILENT
+  #else
+    #define LOG_LEVEL_MAX LOG_LEVEL_TRACE
+  #endif
+#endif
+
 #define LEVEL_ABBREV_CRITICAL "CRIT"
 #define LEVEL_ABBREV_ERROR    "ERRO"
 #define LEVEL_ABBREV_WARNING  "WARN"
@@ -24,6 +57,237 @@
 #define LEVEL_ABBREV_DEBUG    "DBUG"
 #define LEVEL_ABBREV_TRACE    "TRCE"
 
+// Size of the buffer a complete log line (prefix, message and end of line) is rendered into
+// before being written to the output in one go. Longer lines are truncated.
+#ifndef LOG_LINE_BUFFER_SIZE
+  #define LOG_LINE_BUFFER_SIZE 128
+#endif
+
+// Number of module names that can have a level of their own, see Logging::setModuleLevel()
+#ifndef LOG_MAX_MODULE_LEVELS
+  #define LOG_MAX_MODULE_LEVELS 8
+#endif
+
+// Number of outputs that can be registered with Logging::addOutput()
+#ifndef LOG_MAX_OUTPUTS
+  #define LOG_MAX_OUTPUTS 4
+#endif
+
+// Number of literal spans and variables a prefix set with Logging::setPrefix() is compiled into.
+// Longer prefixes still work, but are parsed again for every line.
+#ifndef LOG_PREFIX_TOKENS
+  #define LOG_PREFIX_TOKENS 8
+#endif
+
+// Terminates every log line. Defaults to the sequence written by Print::println().
+#ifndef LOG_EOL
+  #define LOG_EOL "\r\n"
+#endif
+
+// Replaces the last characters of a line that did not fit in LOG_LINE_BUFFER_SIZE.
+#ifndef LOG_TRUNCATION_MARK
+  #define LOG_TRUNCATION_MARK "..."
+#endif
+
+// Bytes per line of Logging::hexdump()
+#ifndef LOG_HEXDUMP_WIDTH
+  #define LOG_HEXDUMP_WIDTH 16
+#endif
+
+// 1 keeps the counters returned by Logging::getStatistics(). Each message then also reads micros()
+// twice; 0 compiles the counters out.
+#ifndef LOG_STATISTICS
+  #define LOG_STATISTICS 0
+#endif
+
+/**
+ * Fixed-size buffer a log line is rendered into, so that it reaches the output with a single
+ * Print::write(buffer, size) call instead of one call per character and argument.
+ *
+ * Characters that do not fit are dropped and the line is marked as truncated; finish() then
+ * overwrites the tail of the line with LOG_TRUNCATION_MARK. Room for LOG_EOL is always
+ * reserved, so a finished line is terminated even when truncated.
+ */
+class LogLine : public Print {
+  public:
+    explicit LogLine(int level = LOG_LEVEL_SILENT)
+      : _length(0), _truncated(false), _hasTime(false), _level(level), _time(0) {}
+
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t* buffer, size_t size) override;
+    using Print::write;
+
+    void append(char c);
+    void append(const char* str);
+    void append(const char* str, size_t size);
+    void appendFlash(const __FlashStringHelper* str);
+    // Flash text of a known size, copied in chunks straight into the buffer. The Until variant
+    // stops at the first stop character and returns the number of bytes before it, or size.
+    void appendFlash(PGM_P str, size_t size);
+    size_t appendFlashUntil(PGM_P str, size_t size, char stop);
+    // Integer kernels: decimal two digits per step, hexadecimal and binary a byte at a time.
+    // minDigits pads hexadecimal with leading zeros.
+    void appendDecimal(unsigned long value);
+    void appendDecimal(unsigned long long value);
+    void appendDecimal(long value);
+    void appendDecimal(long long value);
+    void appendHex(unsigned long value, uint8_t minDigits = 1);
+    void appendHex(unsigned long long value, uint8_t minDigits = 1);
+    void appendBinary(unsigned long value);
+    void appendBinary(unsigned long long value);
+    // Bytes as two hexadecimal digits each, separated by separator unless it is zero
+    void appendHexBytes(const uint8_t* data, size_t size, char separator = ' ');
+    // Bytes as text, '.' for those that are not printable
+    void appendAscii(const uint8_t* data, size_t size);
+    void appendFill(char c, size_t count);
+    // Moves the text from position at count places right and fills the gap with c; what no
+    // longer fits is dropped from the end.
+    void insertFill(size_t at, char c, size_t count);
+    // Fixed point with the given number of decimals, at most kMaxFloatDigits
+    void appendFloat(double value, uint8_t digits);
+
+    void clear() { _length = 0; _truncated = false; _hasTime = false; }
+    // Drops the text after the first length characters; what was cut off the end no longer counts
+    void rewind(size_t length) { if (length < _length) { _length = length; _truncated = false; } }
+    void finish();
+
+    const char* data() const { return _buffer; }
+    size_t length() const { return _length; }
+    bool truncated() const { return _truncated; }
+    // Characters that fit ahead of the end of line
+    static size_t capacity() { return kCapacity; }
+
+    // Clock reading shared by all timestamps of the line, taken by the first one
+    bool hasTime() const { return _hasTime; }
+    unsigned long time() const { return _time; }
+    void setTime(unsigned long time) { _time = time; _hasTime = true; }
+
+    // Level of the message, written by %L
+    int level() const { return _level; }
+    void setLevel(int level) { _level = level; }
+
+    static const uint8_t kMaxFloatDigits = 9;
+
+  private:
+    static const size_t kEolLength = sizeof(LOG_EOL) - 1;
+    static const size_t kCapacity = LOG_LINE_BUFFER_SIZE - kEolLength;
+    // Bytes of flash copied ahead of the stop character, at most this many past it are wasted
+    static const size_t kFlashChunk = 16;
+
+    char _buffer[LOG_LINE_BUFFER_SIZE];
+    size_t _length;
+    bool _truncated;
+    bool _hasTime;
+    int _level;
+    unsigned long _time;
+};
+
+/**
+ * HH:MM:SS.mmm text of a millisecond clock, kept from one update to the next. A later time only
+ * rewrites the fields that changed, carrying from the milliseconds upwards; the divisions of a
+ * full conversion are only done for the first time, after a step of kFullUpdate or more, when the
+ * clock went back or when the hours change.
+ */
+class LogTimestamp {
+  public:
+    LogTimestamp() : _time(0), _valid(false), _length(0) { _text[0] = 0; }
+
+    void update(unsigned long time);
+
+    const char* text() const { return _text; }
+    size_t length() const { return _length; }
+
+  private:
+    static const unsigned long kFullUpdate = 10000;
+
+    void render();
+
+    unsigned long _time;
+    unsigned long _hours;
+    uint16_t _millis;
+    uint8_t _seconds;
+    uint8_t _minutes;
+    bool _valid;
+    uint8_t _length;
+    char _text[3 * sizeof(unsigned long) + sizeof(":MM:SS.mmm")];
+};
+
+/**
+ * Token bucket of one call site of the LOG_*_LIMITED() macros: up to burst messages pass at once,
+ * then one per interval milliseconds. A rejected message is only counted, without evaluating its
+ * arguments, and the count is appended to the next message that passes. The constructor is
+ * constexpr, so the static limiter of a call site needs no initialisation code.
+ */
+class LogLimiter {
+  public:
+    constexpr LogLimiter(unsigned long interval, uint8_t burst)
+      : _interval(interval), _last(0), _burst(burst), _tokens(burst), _suppressed(0) {}
+
+    // False if the message is to be suppressed. An interval of 0 admits every message.
+    bool admit(unsigned long now);
+    // Messages suppressed since the last one that passed, which resets the count
+    uint16_t takeSuppressed() {
+      uint16_t suppressed = _suppressed;
+      _suppressed = 0;
+      return suppressed;
+    }
+
+  private:
+    unsigned long _interval;
+    unsigned long _last;
+    uint8_t _burst;
+    uint8_t _tokens;
+    uint16_t _suppressed;
+};
+
+// Admits the first message of a LOG_*_EVERY() call site and then every nth
+class LogEvery {
+  public:
+    constexpr LogEvery(uint16_t n) : _n(n), _skip(0) {}
+
+    bool admit() {
+      if (_skip > 0) {
+        --_skip;
+        return false;
+      }
+      _skip = _n > 0 ? _n - 1 : 0;
+      return true;
+    }
+
+  private:
+    uint16_t _n;
+    uint16_t _skip;
+};
+
+#if LOG_STATISTICS
+  // Counters since the start or the last Logging::resetStatistics()
+  struct LogStatistics {
+    uint32_t messages[LOG_LEVEL_TRACE + 1];  // messages logged, by level
+    uint32_t filtered;     // log calls above the threshold of their instance
+    uint32_t bytes;        // bytes of lines and records written, counted once for all outputs
+    uint32_t truncated;    // lines and records cut to fit their buffer
+    uint32_t dropped;      // messages lost by a full asynchronous buffer
+    uint32_t totalMicros;  // time spent formatting and writing messages
+    uint32_t maxMicros;    // longest single message
+  };
+#endif
+
+class Logging;
+class LogEvent;
+class LogTimer;
+namespace ArduinoLogFormat {
+  struct Access;
+
+  // Modifiers between '%' and the conversion character: the flags '-' (align left) and '0' (pad
+  // numbers with zeros), a width of at most 255 and a ".precision".
+  struct Modifiers {
+    int precision;  // -1 without one
+    uint8_t width;  // 0 without one
+    bool left;
+    bool zero;
+  };
+}
+
 /**
  * ArduinoLog is a minimalistic framework to help the programmer output log statements to an output of choice, 
  * fashioned after extensive logging libraries such as log4cpp ,log4j and log4net. In case of problems with an
@@ -41,13 +305,21 @@
  * %l	display as long value
  * %u	display as unsigned long value
  * %x	display as hexadecimal value
- * %X	display as hexadecimal value prefixed by `0x` and leading zeros
+ * %X	display as hexadecimal value prefixed by `0x`, padded to at least 4 digits with leading zeros
  * %b	display as binary number
  * %B	display as binary number, prefixed by `0b`
  * %t	display as boolean value "t" or "f"
  * %T	display as boolean value "true" or "false"
- * %D,%F display as double value
- * %p    display a  printable object 
+ * %f,%D,%F display as floating point value with setDigit() decimals, or the precision given as
+ *       in %.3f (at most 9)
+ * %p    display a printable object (Printable*)
+ * %h    display a buffer as hexadecimal bytes separated by spaces; takes two arguments, a pointer
+ *       and a length (int). Binary records keep at most 255 bytes.
+ *
+ * Between '%' and the wildcard go, as in printf, the flags '-' (align left) and '0' (pad numbers
+ * with zeros), a width of at most 255 and a precision: %-12s, %08x, %6.3f. The precision is the
+ * number of decimals of %f, %D and %F, the minimum number of digits of the other numbers and the
+ * maximum number of characters of everything else. Padding is inserted into the line buffer.
  * 
  * ---- Internal Variables (auto-injected, don't consume arguments)
  * 
@@ -63,93 +335,410 @@
 class Logging {
   public:
     explicit Logging(const char* moduleName = nullptr);
-    ~Logging() = default;
+    Logging(const Logging& other);
+    Logging& operator=(const Logging& other);
+    ~Logging();
 
     static void setLevel(int level);
+    // Threshold of every instance with this module name, including instances created later, in
+    // place of setLevel(); LOG_LEVEL_INHERIT returns them to setLevel(). The name must stay valid.
+    // False if LOG_MAX_MODULE_LEVELS names already have a level of their own.
+    static bool setModuleLevel(const char* moduleName, int level);
+    // Threshold in effect for this instance
+    int getLevel() const;
+    // Replaces every output by this one, which receives all levels enabled by setLevel()
     static void setOutput(Print* output);
+    // Adds an output that receives the messages up to the given level, or changes the level of
+    // an output already added. A message is formatted once and written to every output whose level
+    // admits it. False if LOG_MAX_OUTPUTS outputs are registered.
+    static bool addOutput(Print* output, int level = LOG_LEVEL_TRACE);
+    static void removeOutput(Print* output);
+    // Sets a format written before every message; it may use the internal variables, and must stay
+    // valid while it is set. It is parsed once here rather than for every line.
     static void setPrefix(const char* format);
     static void clearPrefix();
+    // Decimals of %f, %D and %F without a precision of their own (at most 9)
     static void setDigit(int digit);
 
-    template <class T, typename... Args> void critical(T msg, Args... args) {
+    // Source of the %m and %M timestamps and of binary records, in milliseconds. Defaults to
+    // millis(); nullptr restores it.
+    typedef unsigned long (*Clock)();
+    static void setClock(Clock clock);
+
+    // Switches between text output and the binary stream described in ArduinoLogBinary.hpp.
+    // Enabling it starts a new stream: the header and every format are sent again.
+    static void setBinaryMode(bool enabled);
+
+    #if LOG_ASYNC_BUFFER_SIZE > 0
+      // In asynchronous mode log calls only queue the finished message; drain() writes the queued
+      // messages to the output, from loop() or from a task of its own (see startDrainTask()).
+      // Disabling it drains what is left.
+      static void setAsync(bool enabled);
+      // LOG_OVERFLOW_BLOCK only works with drain() called from another task than the log calls.
+      // AVR and ESP8266 have no such task and drop the newest message instead.
+      static void setOverflowPolicy(uint8_t policy);
+      static size_t drain();
+      static uint32_t getDroppedCount();
+
+      #ifdef ESP32
+        // Starts a FreeRTOS task that drains the buffer every tick
+        static bool startDrainTask(uint32_t stackSize = 2048, UBaseType_t priority = 1,
+                                   BaseType_t core = tskNO_AFFINITY);
+      #endif
+    #endif
+
+    #if LOG_BATCH_SIZE > 0
+      // Collects finished messages into a block of LOG_BATCH_SIZE bytes, which is written to the
+      // outputs at once: when it is full, maxAge milliseconds after its first message, when a
+      // message at flushLevel or more severe arrives, or on flush(). The age is checked as messages
+      // arrive; call flushIfDue() from loop() so a quiet period does not hold them back longer.
+      // Disabling it flushes the block.
+      static void setBatching(bool enabled, unsigned long maxAge = 1000, int flushLevel = LOG_LEVEL_ERROR);
+      static void flush();
+      static void flushIfDue();
+    #endif
+
+    #if LOG_FLIGHT_RECORDER
+      // Records the messages up to level, before any formatting, into memory that survives a
+      // reset, such as a LOG_RETAINED buffer (see ArduinoLogFlightRecorder.hpp); the threshold of
+      // setLevel() still applies. Records left by the same build are kept, and then it returns
+      // true. nullptr stops recording.
+      static bool setFlightRecorder(void* memory, size_t size, int level = LOG_LEVEL_TRACE);
+      static void clearFlightRecorder();
+      // Writes the recorded messages, oldest first, formatted with the current prefix and with
+      // their own level and time. Returns the number of messages.
+      size_t dumpFlightRecorder(Print& output);
+    #endif
+
+    #if LOG_STATISTICS
+      static void getStatistics(LogStatistics& statistics);
+      static void resetStatistics();
+      // Source of the statistics times, in microseconds. Defaults to micros(); nullptr restores it.
+      static void setStatisticsClock(Clock clock);
+      // Writes the counters as two lines of text
+      static void printStatistics(Print& output);
+    #endif
+
+    // True if a message at the given level would be written. Guard costly argument evaluation with
+    // it, or use the LOG_* macros which do so.
+    bool isEnabled(int level) const {
       #ifndef DISABLE_LOGGING
-        printLevel(LOG_LEVEL_CRITICAL, msg, args...);
+        return level <= _enabledLevel;
+      #else
+        return false;
       #endif
     }
 
-    template <class T, typename... Args> void error(T msg, Args... args) {
+    // isEnabled() of the log methods and macros, which also counts a dropped call as filtered
+    bool shouldLog(int level) const {
       #ifndef DISABLE_LOGGING
-        printLevel(LOG_LEVEL_ERROR, msg, args...);
+        #if LOG_STATISTICS
+          if (level > _enabledLevel) {
+            #if LOG_THREAD_SAFE
+              __atomic_fetch_add(&_statistics.filtered, 1, __ATOMIC_RELAXED);
+            #else
+              ++_statistics.filtered;
+            #endif
+            return false;
+          }
+          return true;
+        #else
+          return level <= _enabledLevel;
+        #endif
+      #else
+        return false;
+      #endif
+    }
+
+    template <class T, typename... Args> void critical(T msg, Args... args) {
+      #if LOG_LEVEL_MAX >= LOG_LEVEL_CRITICAL
+        if (shouldLog(LOG_LEVEL_CRITICAL))
+          printLevel(LOG_LEVEL_CRITICAL, msg, args...);
+      #endif
+    }
+
+    template <class T, typename... Args> void error(T msg, Args... args) {
+      #if LOG_LEVEL_MAX >= LOG_LEVEL_ERROR
+        if (shouldLog(LOG_LEVEL_ERROR))
+          printLevel(LOG_LEVEL_ERROR, msg, args...);
       #endif
     }
 
     template <class T, typename... Args> void warning(T msg, Args...args) {
-      #ifndef DISABLE_LOGGING
-        printLevel(LOG_LEVEL_WARNING, msg, args...);
+      #if LOG_LEVEL_MAX >= LOG_LEVEL_WARNING
+        if (shouldLog(LOG_LEVEL_WARNING))
+          printLevel(LOG_LEVEL_WARNING, msg, args...);
       #endif
     }
 
     template <class T, typename... Args> void info(T msg, Args...args) {
-      #ifndef DISABLE_LOGGING
-        printLevel(LOG_LEVEL_INFO, msg, args...);
+      #if LOG_LEVEL_MAX >= LOG_LEVEL_INFO
+        if (shouldLog(LOG_LEVEL_INFO))
+          printLevel(LOG_LEVEL_INFO, msg, args...);
       #endif
     }
 
     template <class T, typename... Args> void debug(T msg, Args... args) {
-      #ifndef DISABLE_LOGGING
-        printLevel(LOG_LEVEL_DEBUG, msg, args...);
+      #if LOG_LEVEL_MAX >= LOG_LEVEL_DEBUG
+        if (shouldLog(LOG_LEVEL_DEBUG))
+          printLevel(LOG_LEVEL_DEBUG, msg, args...);
       #endif
     }
 
     template <class T, typename... Args> void trace(T msg, Args... args) {
-      #ifndef DISABLE_LOGGING
-        printLevel(LOG_LEVEL_TRACE, msg, args...);
+      #if LOG_LEVEL_MAX >= LOG_LEVEL_TRACE
+        if (shouldLog(LOG_LEVEL_TRACE))
+          printLevel(LOG_LEVEL_TRACE, msg, args...);
       #endif
     }
+
+    // Writes size bytes from data at the given level, LOG_HEXDUMP_WIDTH per line: each line has the
+    // prefix, the offset, the bytes in hexadecimal and, with ascii, the bytes as text, e.g.
+    //   0x0000: 48 65 6C 6C 6F 0D 0A  Hello..
+    // Binary and flight records keep the offset and the bytes, not the text.
+    void hexdump(int level, const void* data, size_t size, bool ascii = true);
+
+    // Entry point of the LOG_CRITICAL() ... LOG_TRACE() macros, which check the level first, see
+    // ArduinoLogFormat.hpp
+    template <class Format, typename... Args> void printCompiled(int level, const Args&... args);
+    // Entry points of the LOG_*_LIMITED() macros
+    bool admit(LogLimiter& limiter);
+    template <class Format, typename... Args> void printLimited(int level, LogLimiter& limiter, const Args&... args);
+    // Messages suppressed by all LOG_*_LIMITED() call sites
+    static uint32_t getSuppressedCount();
+    // Entry point of the LOG_*_SAMPLED() macros: true with probability threshold / 65535, from a
+    // 16 bit xorshift generator
+    static bool sampled(uint32_t threshold);
+    static constexpr uint32_t sampleThreshold(double probability) {
+      return probability >= 1.0 ? 65535UL : probability <= 0.0 ? 0UL : (uint32_t) (probability * 65535.0 + 0.5);
+    }
     
     static const char* _prefixFormat;
+    virtual void printInternal(LogLine& out, char format);
+    // Deprecated, override printInternal(LogLine&, char) instead. Overrides of this form are still
+    // called for the prefix variables the library does not know, with _logOutput set to the line.
+    __attribute__((deprecated("override printInternal(LogLine&, char)")))
     virtual void printInternal(char format);
-    static Print* _logOutput;
+
+    // Kept for existing code: reads as the first output, or as the line being built inside an
+    // override of a deprecated printInternal(char) or printFormat(char, va_list*). Assigning it
+    // calls setOutput().
+    class LegacyOutput {
+      public:
+        Print* operator->() const { return get(); }
+        operator Print*() const { return get(); }
+        LegacyOutput& operator=(Print* output) {
+          setOutput(output);
+          return *this;
+        }
+
+      private:
+        Print* get() const;
+    };
+    static LegacyOutput _logOutput;
 
   protected:
-      void printFormat(const char format, va_list *args);
+      // Renders the specifier format of a message, taking its argument from args. A subclass
+      // adds specifiers of its own by overriding it and passing the others on.
+      virtual void printFormat(LogLine& out, const char format, va_list *args, int precision = -1);
+      // Deprecated, override printFormat(LogLine&, char, va_list*, int) instead. Overrides of this
+      // form are still called for the specifiers the library does not know, with _logOutput set to
+      // the line.
+      __attribute__((deprecated("override printFormat(LogLine&, char, va_list*, int)")))
+      virtual void printFormat(const char format, va_list *args);
       const char* getLevelAbbrev(int level);
 
   private:
-    void println(const char *format, va_list args);
+    void println(LogLine& out, const char *format, va_list args);
 
-    void println(const __FlashStringHelper *format, va_list args);
+    void println(LogLine& out, const __FlashStringHelper *format, va_list args);
 
-    void println(const Printable& obj, va_list args) {
+    void println(LogLine& out, const Printable& obj, va_list args) {
       #ifndef DISABLE_LOGGING
-        _logOutput->println(obj);
+        obj.printTo(out);
       #endif
     }
 
-  private:
-    void printPrefixFormat();
-    template <class T> void printLevel(int level, T msg, ...) {
-      #ifndef DISABLE_LOGGING
-        if (level > _level)
-          return;                    
+    void printBinary(int level, const char *format, va_list args);
 
-        _currentLevel = level;
+    void printBinary(int level, const __FlashStringHelper *format, va_list args);
 
-        if (_prefixFormat != nullptr) {
-          printPrefixFormat();
-        }
+    void printBinary(int level, const Printable& obj, va_list args);
+
+    void encodeArguments(LogRecord& out, const char *format, va_list args);
+
+    void encodeArguments(LogRecord& out, const __FlashStringHelper *format, va_list args);
+
+    #if LOG_FLIGHT_RECORDER
+      void recordFlight(int level, const char *format, va_list args);
+      void recordFlight(int level, const __FlashStringHelper *format, va_list args);
+      void recordFlight(int level, const Printable& obj, va_list args);
+      void beginFlightRecord(int level, const void* format, uint8_t flags);
+      void endFlightRecord();
+      void printFlightRecord(LogLine& out, const uint8_t* record, size_t size);
+      bool printRecordArgument(LogLine& out, char format, int precision, bool wide, LogRecordReader& in);
+    #endif
+
+  private:
+    friend struct ArduinoLogFormat::Access;
+    friend class LogEvent;
+    friend class LogTimer;
 
-        va_list args;
-        va_start(args, msg);
-        println(msg, args);
-        va_end(args);
+    static unsigned long now() {
+      #ifndef DISABLE_LOGGING
+        return _clock != nullptr ? _clock() : millis();
+      #else
+        return 0;
       #endif
     }
+    static unsigned long freeMemory();
+    void printPrefixFormat(LogLine& out);
+    static bool addPrefixToken(const char* text, size_t length, char spec,
+                               const ArduinoLogFormat::Modifiers& modifiers);
+    void writeLine(LogLine& out, int level);
+    bool beginRecord(int level, const void* format, bool flash, uint8_t flags);
+    void encodeFormat(LogRecord& out, const char format, va_list *args, int precision = -1);
+    void encodeInternal(LogRecord& out, char format);
+    bool writeRecord(LogRecord& out, int level);
+    bool writeOutput(const uint8_t* data, size_t size, int level);
+    static void dispatch(const uint8_t* data, size_t size, int level);
+    #if LOG_BATCH_SIZE > 0
+      static bool batch(const uint8_t* data, size_t size, int level);
+      static void flushBatch();
+    #endif
+    static void updateEnabledLevel();
+    static int findModuleLevel(const char* moduleName);
+    void link();
+    void updateInstanceLevel();
+    // The compiled formats of ArduinoLogFormat.hpp render their arguments, passed by address in
+    // args, through one of these per format; everything else is shared by all call sites.
+    typedef void (*LineEmitter)(Logging& log, LogLine& out, const void* const* args);
+    typedef void (*RecordEmitter)(Logging& log, LogRecord& out, const void* const* args);
+    void printCompiledLine(int level, uint16_t suppressed, const char* format, LineEmitter line,
+                           RecordEmitter record, const void* const* args);
+    static void appendSuppressed(LogLine& out, uint16_t suppressed);
+    // Out-of-line entry points of critical() ... trace(), called once the level is enabled, so a
+    // call site only holds the level check and the call
+    void printLevel(int level, const char* msg, ...);
+    void printLevel(int level, const __FlashStringHelper* msg, ...);
+    void printLevel(int level, const Printable& obj);
+    void printObject(int level, const Printable* obj, ...);
+    template <class T> void printMessage(int level, T msg, va_list args);
 
     #ifndef DISABLE_LOGGING
       static int _level;
-      int _currentLevel;
+      static int _outputLevel;  // highest output level
+      static Print* _outputs[LOG_MAX_OUTPUTS];
+      static int _outputLevels[LOG_MAX_OUTPUTS];
+      static uint8_t _outputCount;
+      static const char* _moduleLevelNames[LOG_MAX_MODULE_LEVELS];
+      static int _moduleLevels[LOG_MAX_MODULE_LEVELS];
+      static Logging* _instances;  // every instance, so level changes reach their cached levels
+      Logging* _next;
+      int _moduleLevel;
+      int _enabledLevel;  // lower of the threshold and the highest output level
       const char* _moduleName;
+      static uint32_t _suppressedCount;
+      static uint16_t _sampleState;
       static int _digit;
+      static Clock _clock;
+      static LogTimestamp _timestamp;
+      // Line of the deprecated override being called, which _logOutput reads as. Each thread has
+      // its own, so another thread's log call or use of _logOutput never sees it.
+      #if LOG_THREAD_SAFE
+        static thread_local LogLine* _legacyLine;
+      #else
+        static LogLine* _legacyLine;
+      #endif
+
+      // A literal span of the prefix (spec zero), or an internal variable and its modifiers
+      struct PrefixToken {
+        const char* text;
+        uint8_t length;
+        char spec;
+        ArduinoLogFormat::Modifiers modifiers;
+      };
+      static PrefixToken _prefixTokens[LOG_PREFIX_TOKENS];
+      static uint8_t _prefixTokenCount;
+      static bool _prefixCompiled;
+      static bool _binaryMode;
+      static LogRecord _record;
+      static const void* _binaryFormats[LOG_BINARY_FORMATS];
+      static uint8_t _binaryFormatFlags[LOG_BINARY_FORMATS];
+      static uint8_t _binaryFormatCount;
+      static uint8_t _binaryNextFormat;
+      #if LOG_ASYNC_BUFFER_SIZE > 0
+        static bool _async;
+        static uint8_t _overflowPolicy;
+        static LogRing _ring;
+      #endif
+      #if LOG_BATCH_SIZE > 0
+        static bool _batching;
+        static unsigned long _batchMaxAge;
+        static int _batchFlushLevel;
+        static LogBatch _batch;
+      #endif
+      #if LOG_FLIGHT_RECORDER
+        static LogFlightRecorder _recorder;
+        static int _recorderLevel;
+      #endif
+      #if LOG_STATISTICS
+        // Counts a message and the time until it goes out of scope
+        class StatisticsScope {
+          public:
+            explicit StatisticsScope(int level) : _level(level), _start(microsNow()) {}
+            ~StatisticsScope() { countMessage(_level, microsNow() - _start); }
+
+          private:
+            int _level;
+            unsigned long _start;
+        };
+        static unsigned long microsNow() {
+          return _statisticsClock != nullptr ? _statisticsClock() : micros();
+        }
+        static void countMessage(int level, unsigned long elapsed);
+        // Counters are updated without a lock, so counting never waits for an output
+        static void addStatistic(uint32_t& counter, uint32_t value) {
+          #if LOG_THREAD_SAFE
+            __atomic_fetch_add(&counter, value, __ATOMIC_RELAXED);
+          #else
+            counter += value;
+          #endif
+        }
+        static LogStatistics _statistics;
+        static Clock _statisticsClock;
+      #endif
+
+      // With LOG_THREAD_SAFE, OutputLock is held while writing to the outputs and changing them,
+      // RecordLock while using the shared binary record, the format table or the flight recorder.
+      // A thread holding both took RecordLock first. Pushing to the asynchronous buffer takes
+      // neither, so a log call never waits for the drain's write. Without LOG_THREAD_SAFE they do
+      // nothing. Both are recursive, so an output may log.
+      class OutputLock {
+        public:
+          #if LOG_THREAD_SAFE
+            OutputLock() { _mutex.lock(); }
+            ~OutputLock() { _mutex.unlock(); }
+          #else
+            OutputLock() {}
+          #endif
+      };
+      class RecordLock {
+        public:
+          #if LOG_THREAD_SAFE
+            RecordLock() { _recordMutex.lock(); }
+            ~RecordLock() { _recordMutex.unlock(); }
+          #else
+            RecordLock() {}
+          #endif
+      };
+      #if LOG_THREAD_SAFE
+        static std::recursive_mutex _mutex;
+        static std::recursive_mutex _recordMutex;
+      #endif
     #endif
 };
+
+#include "ArduinoLogFormat.hpp"
+#include "ArduinoLogEvent.hpp"
+#include "ArduinoLogTimer.hpp"
@@ -0,0 +1,45 @@
+#include "ArduinoLogBatch.hpp"
+
+#if LOG_BATCH_SIZE > 0
+
+static_assert(LOG_BATCH_SIZE <= 65535, "LOG_BATCH_SIZE must be at most 65535");
+static_assert(LOG_BATCH_MESSAGES > 0 && LOG_BATCH_MESSAGES <= 255, "LOG_BATCH_MESSAGES must be 1 to 255");
+
+bool LogBatch::add(uint8_t level, const uint8_t* data, size_t size, unsigned long now) {
+  if (_count == LOG_BATCH_MESSAGES || size > (size_t) (LOG_BATCH_SIZE - _length))
+    return false;
+
+  if (_count == 0) {
+    _start = now;
+  }
+  memcpy(_data + _length, data, size);
+  _length += (uint16_t) size;
+  _ends[_count] = _length;
+  _levels[_count] = level;
+  ++_count;
+  return true;
+}
+
+void LogBatch::flush(Print* const* outputs, const int* levels, uint8_t count) {
+  for (uint8_t output = 0; output < count; ++output) {
+    // A message the output does not take ends the run of messages written so far
+    uint16_t run = 0;
+    uint16_t begin = 0;
+    for (uint8_t i = 0; i < _count; ++i) {
+      if (_levels[i] > levels[output]) {
+        if (begin > run) {
+          outputs[output]->write(_data + run, begin - run);
+        }
+        run = _ends[i];
+      }
+      begin = _ends[i];
+    }
+    if (_length > run) {
+      outputs[output]->write(_data + run, _length - run);
+    }
+  }
+  _length = 0;
+  _count = 0;
+}
+
+#endif
@@ -0,0 +1,49 @@
+#pragma once
+#include "Arduino.h"
+
+#include <inttypes.h>
+
+// Size in bytes of the block Logging::setBatching() collects messages in, at most 65535. 0
+// compiles batching out.
+#ifndef LOG_BATCH_SIZE
+  #define LOG_BATCH_SIZE 0
+#endif
+
+// Most messages a block holds, however short they are
+#ifndef LOG_BATCH_MESSAGES
+  #define LOG_BATCH_MESSAGES 16
+#endif
+
+#if LOG_BATCH_SIZE > 0
+
+/**
+ * Block of finished messages that are written to the outputs together, so that an output sending
+ * a network packet per write sends one for many lines.
+ *
+ * The messages are kept back to back, with the end and level of each in a table beside them. An
+ * output gets the messages its level admits, consecutive ones in a single write; with one output
+ * or outputs that take every level, that is one write for the whole block.
+ */
+class LogBatch {
+  public:
+    LogBatch() : _length(0), _count(0), _start(0) {}
+
+    // False if the message does not fit beside the messages already in the block
+    bool add(uint8_t level, const uint8_t* data, size_t size, unsigned long now);
+    // Writes the messages to each output whose level admits them and empties the block
+    void flush(Print* const* outputs, const int* levels, uint8_t count);
+
+    bool empty() const { return _count == 0; }
+    // Time the first message in the block was added
+    unsigned long start() const { return _start; }
+
+  private:
+    uint8_t _data[LOG_BATCH_SIZE];
+    uint16_t _ends[LOG_BATCH_MESSAGES];
+    uint8_t _levels[LOG_BATCH_MESSAGES];
+    uint16_t _length;
+    uint8_t _count;
+    unsigned long _start;
+};
+
+#endif
@@ -0,0 +1,324 @@
+#include "ArduinoLog.hpp"
+
+static_assert(LOG_BINARY_RECORD_SIZE >= 16 && LOG_BINARY_RECORD_SIZE <= 258,
+              "LOG_BINARY_RECORD_SIZE must leave room for a record header and fit a frame");
+static_assert(LOG_BINARY_FORMATS > 0 && LOG_BINARY_FORMATS <= 256,
+              "LOG_BINARY_FORMATS must fit a one byte format id");
+
+#ifndef DISABLE_LOGGING
+  // Format of a Printable logged as the message
+  static const char kPrintableFormat[] = "%p";
+#endif
+
+void Logging::printBinary(int level, const char *format, va_list args) {
+  #ifndef DISABLE_LOGGING
+    RecordLock lock;
+    if (!beginRecord(level, format, false, 0))
+      return;
+    encodeArguments(_record, format, args);
+    writeRecord(_record, level);
+  #endif
+}
+
+void Logging::printBinary(int level, const __FlashStringHelper *format, va_list args) {
+  #ifndef DISABLE_LOGGING
+    RecordLock lock;
+    if (!beginRecord(level, format, true, 0))
+      return;
+    encodeArguments(_record, format, args);
+    writeRecord(_record, level);
+  #endif
+}
+
+void Logging::printBinary(int level, const Printable& obj, va_list args) {
+  #ifndef DISABLE_LOGGING
+    RecordLock lock;
+    if (!beginRecord(level, kPrintableFormat, false, 0))
+      return;
+    _record.putPrintable(obj);
+    writeRecord(_record, level);
+  #endif
+}
+
+void Logging::encodeArguments(LogRecord& out, const char *format, va_list args) {
+  #ifndef DISABLE_LOGGING
+    ArduinoLogFormat::Modifiers modifiers;
+    // This copy is only necessary on some architectures (x86) to change a passed
+    // array in to a va_list.
+    #ifdef __x86_64__
+      va_list args_copy;
+      va_copy(args_copy, args);
+    #endif
+
+    for (; *format != 0; ++format) {
+      if (*format == '%') {
+        format = ArduinoLogFormat::parseModifiers(format + 1, modifiers);
+        if (*format == 0)
+          break;
+        #ifdef __x86_64__
+          encodeFormat(out, *format, &args_copy, modifiers.precision);
+        #else
+          encodeFormat(out, *format, &args, modifiers.precision);
+        #endif
+      }
+    }
+
+    #ifdef __x86_64__
+      va_end(args_copy);
+    #endif
+  #endif
+}
+
+void Logging::encodeArguments(LogRecord& out, const __FlashStringHelper *format, va_list args) {
+  #ifndef DISABLE_LOGGING
+    PGM_P p = reinterpret_cast<PGM_P>(format);
+    ArduinoLogFormat::Modifiers modifiers;
+    // This copy is only necessary on some architectures (x86) to change a passed
+    // array in to a va_list.
+    #ifdef __x86_64__
+      va_list args_copy;
+      va_copy(args_copy, args);
+    #endif
+
+    char c = pgm_read_byte(p++);
+    for(;c != 0; c = pgm_read_byte(p++)) {
+      if (c == '%') {
+        p = ArduinoLogFormat::parseFlashModifiers(p, modifiers);
+        c = pgm_read_byte(p++);
+        if (c == 0)
+          break;
+        #ifdef __x86_64__
+          encodeFormat(out, c, &args_copy, modifiers.precision);
+        #else
+          encodeFormat(out, c, &args, modifiers.precision);
+        #endif
+      }
+    }
+
+    #ifdef __x86_64__
+      va_end(args_copy);
+    #endif
+  #endif
+}
+
+// False if the header or the format frame was dropped by the asynchronous buffer. The table is
+// then cleared, so the next record starts the stream again, and the record is left out as the
+// host could not decode it.
+bool Logging::beginRecord(int level, const void* format, bool flash, uint8_t flags) {
+  #ifndef DISABLE_LOGGING
+    uint8_t id = 0;
+    while (id < _binaryFormatCount && (_binaryFormats[id] != format || _binaryFormatFlags[id] != flags)) {
+      ++id;
+    }
+
+    if (id == _binaryFormatCount) {
+      if (_binaryFormatCount == 0) {
+        const uint16_t endianness = 1;
+        _record.begin(LOG_FRAME_HEADER);
+        _record.put8(LOG_BINARY_VERSION);
+        _record.put8(sizeof(int));
+        _record.put8(sizeof(long));
+        _record.put8(sizeof(double));
+        _record.put8(*reinterpret_cast<const uint8_t*>(&endianness));
+        if (!writeRecord(_record, LOG_LEVEL_SILENT))
+          return false;
+      }
+
+      if (_binaryFormatCount < LOG_BINARY_FORMATS) {
+        ++_binaryFormatCount;
+      } else {
+        id = _binaryNextFormat;
+        _binaryNextFormat = (_binaryNextFormat + 1) % LOG_BINARY_FORMATS;
+      }
+      _binaryFormats[id] = format;
+      _binaryFormatFlags[id] = flags;
+
+      // Two bytes of the payload go to the id and the flags
+      size_t length = flash ? strlen_P(reinterpret_cast<PGM_P>(format))
+                            : strlen(reinterpret_cast<const char*>(format));
+      if (length + 1 > LogRecord::kMaxPayload - 2) {
+        flags |= LOG_FORMAT_TRUNCATED;
+      }
+
+      _record.begin(LOG_FRAME_FORMAT);
+      _record.put8(id);
+      _record.put8(flags);
+      if (flash) {
+        _record.putFlashString(reinterpret_cast<const __FlashStringHelper*>(format));
+      } else {
+        _record.putString(reinterpret_cast<const char*>(format));
+      }
+      if (!writeRecord(_record, LOG_LEVEL_SILENT)) {
+        _binaryFormatCount = 0;
+        _binaryNextFormat = 0;
+        return false;
+      }
+    }
+
+    _record.begin(LOG_FRAME_RECORD);
+    _record.put8(id);
+    _record.put8(level);
+    _record.put32(now());
+  #endif
+  return true;
+}
+
+void Logging::encodeFormat(LogRecord& out, const char format, va_list *args, int precision) {
+  #ifndef DISABLE_LOGGING
+    if (format == 's') {
+      out.putString(va_arg(*args, char *));
+    }
+    else if (format == 'S') {
+      out.putFlashString(va_arg(*args, __FlashStringHelper *));
+    }
+    else if (format == 'p') {
+      Printable *obj = va_arg(*args, Printable *);
+      if (obj != nullptr) {
+        out.putPrintable(*obj);
+      } else {
+        out.put8(0);
+      }
+    }
+    else if (format == 'h') {
+      const void* data = va_arg(*args, const void *);
+      out.putBytes(data, ArduinoLogFormat::byteCount(va_arg(*args, int)));
+    }
+
+    else if (format == 'l') {
+      long value = va_arg(*args, long);
+      out.put(&value, sizeof(value));
+    }
+    else if (format == 'u') {
+      unsigned long value = va_arg(*args, unsigned long);
+      out.put(&value, sizeof(value));
+    }
+    else if (format == 'f' || format == 'D' || format == 'F') {
+      double value = va_arg(*args, double);
+      out.put8(precision >= 0 ? precision : _digit);
+      out.put(&value, sizeof(value));
+    }
+
+    else if (format == 'd' || format == 'x' || format == 'X' || format == 'b' || format == 'B' ||
+             format == 'c' || format == 'C' || format == 't' || format == 'T') {
+      int value = va_arg(*args, int);
+      out.put(&value, sizeof(value));
+    }
+
+    // Internal variables - don't consume va_arg
+    else if (format == 'L' || format == 'v' || format == 'n' || format == 'm' || format == 'M' || format == 'r') {
+      encodeInternal(out, format);
+    }
+  #endif
+}
+
+void Logging::encodeInternal(LogRecord& out, char format) {
+  #ifndef DISABLE_LOGGING
+    // %L, %m and %M are rebuilt from the record level and timestamp
+    if (format == 'v') {
+      out.put8(getLevel());
+    }
+    else if (format == 'n') {
+      out.putString(_moduleName != nullptr ? _moduleName : "");
+    }
+    else if (format == 'r') {
+      out.put32(freeMemory());
+    }
+  #endif
+}
+
+// Called with RecordLock held
+bool Logging::writeRecord(LogRecord& out, int level) {
+  #ifndef DISABLE_LOGGING
+    out.finish();
+    #if LOG_STATISTICS
+      if (out.truncated()) {
+        addStatistic(_statistics.truncated, 1);
+      }
+    #endif
+    return writeOutput(out.data(), out.length(), level);
+  #else
+    return true;
+  #endif
+}
+
+void LogRecord::begin(uint8_t type) {
+  _buffer[0] = LOG_FRAME_SYNC;
+  _buffer[1] = type;
+  _buffer[2] = 0;
+  _length = kHeaderLength;
+  _truncated = false;
+}
+
+void LogRecord::finish() {
+  _buffer[2] = (uint8_t) (_length - kHeaderLength);
+}
+
+size_t LogRecord::write(uint8_t c) {
+  if (_truncated || _length >= LOG_BINARY_RECORD_SIZE) {
+    _truncated = true;
+    return 0;
+  }
+  _buffer[_length++] = c;
+  return 1;
+}
+
+size_t LogRecord::write(const uint8_t* buffer, size_t size) {
+  if (_truncated)
+    return 0;
+
+  size_t room = LOG_BINARY_RECORD_SIZE - _length;
+  if (size > room) {
+    size = room;
+    _truncated = true;
+  }
+  memcpy(_buffer + _length, buffer, size);
+  _length += size;
+  return size;
+}
+
+void LogRecord::put32(uint32_t value) {
+  uint8_t bytes[4] = {
+    (uint8_t) value, (uint8_t) (value >> 8), (uint8_t) (value >> 16), (uint8_t) (value >> 24)
+  };
+  put(bytes, sizeof(bytes));
+}
+
+void LogRecord::putString(const char* str) {
+  if (str != nullptr) {
+    put(str, strlen(str));
+  }
+  put8(0);
+}
+
+void LogRecord::putFlashString(const __FlashStringHelper* str) {
+  if (str != nullptr) {
+    PGM_P p = reinterpret_cast<PGM_P>(str);
+    size_t size = strlen_P(p);
+    uint8_t chunk[16];
+    while (size > 0 && !_truncated) {
+      size_t n = size < sizeof(chunk) ? size : sizeof(chunk);
+      memcpy_P(chunk, p, n);
+      put(chunk, n);
+      p += n;
+      size -= n;
+    }
+  }
+  put8(0);
+}
+
+void LogRecord::putPrintable(const Printable& obj) {
+  obj.printTo(*this);
+  put8(0);
+}
+
+// A record has no room for more than 255 bytes, so the count fits a byte
+void LogRecord::putBytes(const void* data, size_t size) {
+  if (data == nullptr) {
+    size = 0;
+  }
+  if (size > 255) {
+    size = 255;
+  }
+  put8((uint8_t) size);
+  put(data, size);
+}
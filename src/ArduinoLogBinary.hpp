@@ -0,0 +1,108 @@
+#pragma once
+#include "Arduino.h"
+
+#include <inttypes.h>
+
+// Size of the buffer a binary record is encoded into, which also bounds the length of a format
+// string. A frame carries at most 255 payload bytes.
+#ifndef LOG_BINARY_RECORD_SIZE
+  #define LOG_BINARY_RECORD_SIZE 128
+#endif
+
+// Number of format strings remembered by binary mode. When the table is full the oldest slot is
+// reused and its format is sent again.
+#ifndef LOG_BINARY_FORMATS
+  #define LOG_BINARY_FORMATS 32
+#endif
+
+/**
+ * ---- Binary stream
+ *
+ * In binary mode (Logging::setBinaryMode()) a log call does not format anything: it writes the
+ * level, a timestamp and the raw bytes of its arguments, and the text is rebuilt on the host by
+ * extras/decoder. The stream is a sequence of frames
+ *
+ *   0xA5  type  length  payload[length]
+ *
+ * 'H' header   version, sizeof(int), sizeof(long), sizeof(double), 1 if little endian
+ * 'F' format   id, flags, zero terminated format text. Sent the first time a format is used.
+ *              Flag LOG_FORMAT_WIDE_INTEGERS: integer specifiers carry a long instead of an int.
+ *              Flag LOG_FORMAT_TRUNCATED: the text did not fit the record and was cut, without
+ *              its terminator; the decoder marks the messages of the format as truncated.
+ * 'R' record   id, level, timestamp (uint32, little endian), arguments
+ * 'E' event    a LogEvent (ArduinoLogEvent.hpp) as a CBOR map of indefinite length: key 0 the
+ *              timestamp, 1 the level, 2 the module name if there is one, 3 the message, then
+ *              the fields under their names. Integers are CBOR integers, floats single precision.
+ *
+ * Record arguments follow the specifiers of the format in order, in native byte order:
+ *
+ *   %d %c %C %t %T               int (long with LOG_FORMAT_WIDE_INTEGERS)
+ *   %x %X %b %B                  unsigned int (unsigned long with LOG_FORMAT_WIDE_INTEGERS)
+ *   %l / %u                      long / unsigned long
+ *   %f %D %F                     decimals (uint8), double
+ *   %s %S %p %n                  zero terminated text
+ *   %h                           count (uint8, at most 255), that many bytes
+ *   %v                           threshold level (uint8)
+ *   %r                           free memory (uint32, little endian)
+ *   %L %m %M %%                  nothing, taken from the record
+ *
+ * A record that does not fit in LOG_BINARY_RECORD_SIZE is cut; the decoder marks the message as
+ * truncated. Formats are identified by address, so they must be string constants.
+ */
+#define LOG_FRAME_SYNC   0xA5
+#define LOG_FRAME_HEADER 'H'
+#define LOG_FRAME_FORMAT 'F'
+#define LOG_FRAME_RECORD 'R'
+#define LOG_FRAME_EVENT  'E'
+
+#define LOG_EVENT_KEY_TIME    0
+#define LOG_EVENT_KEY_LEVEL   1
+#define LOG_EVENT_KEY_MODULE  2
+#define LOG_EVENT_KEY_MESSAGE 3
+#define LOG_EVENT_KEY_DROPPED 4  // fields left out because the record was full
+
+#define LOG_BINARY_VERSION 1
+
+#define LOG_FORMAT_WIDE_INTEGERS 0x01
+#define LOG_FORMAT_TRUNCATED     0x02
+#define LOG_FORMAT_FLASH         0x04  // flight records only: the format is in flash
+
+/**
+ * Fixed-size buffer a binary frame is encoded into. Once a write does not fit the frame is closed
+ * and all further bytes are dropped, so the payload is always a valid prefix of the record.
+ */
+class LogRecord : public Print {
+  public:
+    LogRecord() : _length(0), _truncated(false) {}
+
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t* buffer, size_t size) override;
+    using Print::write;
+
+    void begin(uint8_t type);
+    void finish();
+
+    void put(const void* data, size_t size) { write(static_cast<const uint8_t*>(data), size); }
+    void put8(uint8_t value) { write(value); }
+    void put32(uint32_t value);
+    void putString(const char* str);
+    void putFlashString(const __FlashStringHelper* str);
+    void putPrintable(const Printable& obj);
+    void putBytes(const void* data, size_t size);
+
+    const uint8_t* data() const { return _buffer; }
+    size_t length() const { return _length; }
+    bool truncated() const { return _truncated; }
+    // The record without its frame header
+    const uint8_t* payload() const { return _buffer + kHeaderLength; }
+    size_t payloadLength() const { return _length - kHeaderLength; }
+
+    static const size_t kHeaderLength = 3;
+    static const size_t kMaxPayload = LOG_BINARY_RECORD_SIZE - kHeaderLength;
+
+  private:
+
+    uint8_t _buffer[LOG_BINARY_RECORD_SIZE];
+    size_t _length;
+    bool _truncated;
+};
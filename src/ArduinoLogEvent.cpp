@@ -0,0 +1,387 @@
+#include "ArduinoLogEvent.hpp"
+
+#ifndef DISABLE_LOGGING
+
+// CBOR major types and simple values
+static const uint8_t kCborUnsigned = 0;
+static const uint8_t kCborNegative = 1;
+static const uint8_t kCborText = 3;
+static const uint8_t kCborIndefiniteMap = 0xBF;
+static const uint8_t kCborFalse = 0xF4;
+static const uint8_t kCborTrue = 0xF5;
+static const uint8_t kCborNull = 0xF6;
+static const uint8_t kCborFloat = 0xFA;
+static const uint8_t kCborBreak = 0xFF;
+
+// Room kept free for the dropped count, at most kMaxDropped, and the closing byte: in binary a key
+// and a one byte integer, in text ,"dropped":9
+static const uint8_t kMaxDropped = 9;
+static const size_t kBinaryReserve = 3;
+static const size_t kTextReserve = 13;
+
+LogEvent::LogEvent(Logging& log, int level, const char* message)
+  : _log(log), _line(level), _enabled(log.shouldLog(level)), _binary(Logging::_binaryMode), _dropped(0)
+{
+  if (_enabled) {
+    begin();
+    size_t start = _line.length();
+    putMessageKey();
+    putText(message);
+    endField(start);
+  }
+}
+
+LogEvent::LogEvent(Logging& log, int level, const __FlashStringHelper* message)
+  : _log(log), _line(level), _enabled(log.shouldLog(level)), _binary(Logging::_binaryMode), _dropped(0)
+{
+  if (_enabled) {
+    begin();
+    size_t start = _line.length();
+    putMessageKey();
+    putFlashText(message);
+    endField(start);
+  }
+}
+
+#else
+
+LogEvent::LogEvent(Logging&, int, const char*) {}
+LogEvent::LogEvent(Logging&, int, const __FlashStringHelper*) {}
+
+#endif
+
+LogEvent& LogEvent::add(const char* key, bool value) {
+  #ifndef DISABLE_LOGGING
+    if (_enabled) {
+      size_t start = _line.length();
+      putKey(key);
+      if (_binary) {
+        _line.write(value ? kCborTrue : kCborFalse);
+      } else if (value) {
+        _line.append("true", 4);
+      } else {
+        _line.append("false", 5);
+      }
+      endField(start);
+    }
+  #endif
+  return *this;
+}
+
+LogEvent& LogEvent::add(const char* key, long value) {
+  #ifndef DISABLE_LOGGING
+    if (_enabled) {
+      size_t start = _line.length();
+      putKey(key);
+      if (!_binary) {
+        _line.appendDecimal(value);
+      } else if (value < 0) {
+        putHead(kCborNegative, (unsigned long) -(value + 1));
+      } else {
+        putHead(kCborUnsigned, (unsigned long) value);
+      }
+      endField(start);
+    }
+  #endif
+  return *this;
+}
+
+LogEvent& LogEvent::add(const char* key, unsigned long value) {
+  #ifndef DISABLE_LOGGING
+    if (_enabled) {
+      size_t start = _line.length();
+      putKey(key);
+      if (_binary) {
+        putHead(kCborUnsigned, value);
+      } else {
+        _line.appendDecimal(value);
+      }
+      endField(start);
+    }
+  #endif
+  return *this;
+}
+
+LogEvent& LogEvent::add(const char* key, long long value) {
+  #ifndef DISABLE_LOGGING
+    if (_enabled) {
+      size_t start = _line.length();
+      putKey(key);
+      if (!_binary) {
+        _line.appendDecimal(value);
+      } else if (value < 0) {
+        putHead(kCborNegative, (unsigned long long) -(value + 1));
+      } else {
+        putHead(kCborUnsigned, (unsigned long long) value);
+      }
+      endField(start);
+    }
+  #endif
+  return *this;
+}
+
+LogEvent& LogEvent::add(const char* key, unsigned long long value) {
+  #ifndef DISABLE_LOGGING
+    if (_enabled) {
+      size_t start = _line.length();
+      putKey(key);
+      if (_binary) {
+        putHead(kCborUnsigned, value);
+      } else {
+        _line.appendDecimal(value);
+      }
+      endField(start);
+    }
+  #endif
+  return *this;
+}
+
+LogEvent& LogEvent::add(const char* key, double value) {
+  #ifndef DISABLE_LOGGING
+    if (_enabled) {
+      size_t start = _line.length();
+      putKey(key);
+      if (_binary) {
+        float single = (float) value;
+        uint32_t bits;
+        memcpy(&bits, &single, sizeof(bits));
+        uint8_t item[5] = {
+          kCborFloat, (uint8_t) (bits >> 24), (uint8_t) (bits >> 16), (uint8_t) (bits >> 8), (uint8_t) bits
+        };
+        _line.write(item, sizeof(item));
+      } else if (isnan(value) || isinf(value) || value > 4294967040.0 || value < -4294967040.0) {
+        _line.append("null", 4);
+      } else {
+        _line.appendFloat(value, Logging::_digit < 0 ? 0 : Logging::_digit);
+      }
+      endField(start);
+    }
+  #endif
+  return *this;
+}
+
+LogEvent& LogEvent::add(const char* key, const char* value) {
+  #ifndef DISABLE_LOGGING
+    if (_enabled) {
+      size_t start = _line.length();
+      putKey(key);
+      putText(value);
+      endField(start);
+    }
+  #endif
+  return *this;
+}
+
+LogEvent& LogEvent::add(const char* key, const __FlashStringHelper* value) {
+  #ifndef DISABLE_LOGGING
+    if (_enabled) {
+      size_t start = _line.length();
+      putKey(key);
+      putFlashText(value);
+      endField(start);
+    }
+  #endif
+  return *this;
+}
+
+void LogEvent::send() {
+  #ifndef DISABLE_LOGGING
+    if (!_enabled)
+      return;
+    _enabled = false;
+
+    int level = _line.level();
+    #if LOG_STATISTICS
+      Logging::StatisticsScope statistics(level);
+    #endif
+
+    if (_dropped > 0) {
+      if (_binary) {
+        _line.write((uint8_t) LOG_EVENT_KEY_DROPPED);
+        putHead(kCborUnsigned, (unsigned long) _dropped);
+      } else {
+        _line.append(",\"dropped\":", 11);
+        _line.appendDecimal((unsigned long) _dropped);
+      }
+    }
+
+    if (!_binary) {
+      _line.append('}');
+      _log.writeLine(_line, level);
+      return;
+    }
+
+    _line.write(kCborBreak);
+    Logging::RecordLock lock;
+    Logging::_record.begin(LOG_FRAME_EVENT);
+    Logging::_record.put(_line.data(), _line.length());
+    _log.writeRecord(Logging::_record, level);
+  #endif
+}
+
+#ifndef DISABLE_LOGGING
+
+// Text: {"time":...,"level":"...","module":"...  Binary: the same fields under keys 0 to 2
+void LogEvent::begin() {
+  unsigned long time = Logging::now();
+  int level = _line.level();
+  const char* module = _log._moduleName;
+
+  if (_binary) {
+    _line.write(kCborIndefiniteMap);
+    _line.write((uint8_t) LOG_EVENT_KEY_TIME);
+    putHead(kCborUnsigned, time);
+    _line.write((uint8_t) LOG_EVENT_KEY_LEVEL);
+    putHead(kCborUnsigned, (unsigned long) level);
+    if (module != nullptr) {
+      _line.write((uint8_t) LOG_EVENT_KEY_MODULE);
+      putText(module);
+    }
+    return;
+  }
+
+  _line.append("{\"time\":", 8);
+  _line.appendDecimal(time);
+  _line.append(",\"level\":\"", 10);
+  _line.append(_log.getLevelAbbrev(level));
+  _line.append('"');
+  if (module != nullptr) {
+    _line.append(",\"module\":", 10);
+    putText(module);
+  }
+}
+
+void LogEvent::putMessageKey() {
+  if (_binary) {
+    _line.write((uint8_t) LOG_EVENT_KEY_MESSAGE);
+  } else {
+    _line.append(",\"msg\":", 7);
+  }
+}
+
+// A field that leaves too little room for the dropped count and the end of the map or object is
+// taken back out whole, so what is sent stays well formed.
+void LogEvent::endField(size_t start) {
+  size_t capacity = LogLine::capacity();
+  if (_binary && capacity > LogRecord::kMaxPayload) {
+    capacity = LogRecord::kMaxPayload;
+  }
+  size_t reserve = _binary ? kBinaryReserve : kTextReserve;
+  if (_line.length() + reserve <= capacity)
+    return;
+  _line.rewind(start);
+  if (_dropped < kMaxDropped) {
+    ++_dropped;
+  }
+}
+
+void LogEvent::putKey(const char* key) {
+  if (_binary) {
+    putText(key);
+    return;
+  }
+  _line.append(",\"", 2);
+  _line.append(key);
+  _line.append("\":", 2);
+}
+
+void LogEvent::putText(const char* value) {
+  if (value == nullptr) {
+    if (_binary) {
+      _line.write(kCborNull);
+    } else {
+      _line.append("null", 4);
+    }
+    return;
+  }
+
+  size_t size = strlen(value);
+  if (_binary) {
+    putHead(kCborText, (unsigned long) size);
+    _line.append(value, size);
+  } else {
+    _line.append('"');
+    appendEscaped(value, size);
+    _line.append('"');
+  }
+}
+
+void LogEvent::putFlashText(const __FlashStringHelper* value) {
+  if (value == nullptr) {
+    putText(nullptr);
+    return;
+  }
+
+  PGM_P p = reinterpret_cast<PGM_P>(value);
+  size_t size = strlen_P(p);
+  if (_binary) {
+    putHead(kCborText, (unsigned long) size);
+    _line.appendFlash(p, size);
+    return;
+  }
+
+  _line.append('"');
+  char chunk[16];
+  while (size > 0) {
+    size_t n = size < sizeof(chunk) ? size : sizeof(chunk);
+    memcpy_P(chunk, p, n);
+    appendEscaped(chunk, n);
+    p += n;
+    size -= n;
+  }
+  _line.append('"');
+}
+
+// JSON escapes quotes, backslashes and control characters; everything else is copied in runs
+void LogEvent::appendEscaped(const char* text, size_t size) {
+  const char* run = text;
+  const char* end = text + size;
+  for (const char* p = text; p < end; ++p) {
+    char c = *p;
+    if (c != '"' && c != '\\' && (uint8_t) c >= 0x20)
+      continue;
+    _line.append(run, p - run);
+    run = p + 1;
+    _line.append('\\');
+    if (c == '"' || c == '\\') {
+      _line.append(c);
+    } else if (c == '\n') {
+      _line.append('n');
+    } else if (c == '\r') {
+      _line.append('r');
+    } else if (c == '\t') {
+      _line.append('t');
+    } else {
+      _line.append("u00", 3);
+      _line.appendHex((unsigned long) (uint8_t) c, 2);
+    }
+  }
+  _line.append(run, end - run);
+}
+
+template <class T> void LogEvent::putHead(uint8_t major, T value) {
+  major <<= 5;
+  uint8_t bytes;
+  if (value < 24) {
+    _line.write((uint8_t) (major | value));
+    return;
+  } else if (value <= 0xFF) {
+    bytes = 1;
+    _line.write((uint8_t) (major | 24));
+  } else if (value <= 0xFFFF) {
+    bytes = 2;
+    _line.write((uint8_t) (major | 25));
+  } else if (value <= 0xFFFFFFFFUL) {
+    bytes = 4;
+    _line.write((uint8_t) (major | 26));
+  } else {
+    bytes = 8;
+    _line.write((uint8_t) (major | 27));
+  }
+  // Big endian, as CBOR wants
+  for (uint8_t i = bytes; i > 0; --i) {
+    _line.write((uint8_t) (value >> (8 * (i - 1))));
+  }
+}
+
+#endif
@@ -0,0 +1,80 @@
+#pragma once
+#include "ArduinoLog.hpp"
+
+/**
+ * Structured message: a level, a message and typed key/value fields, for log collectors that
+ * should not have to parse free text, e.g.
+ *
+ *   LogEvent(Log, LOG_LEVEL_INFO, "reading").add("sensor", id).add("temp", 21.5).add("ok", true);
+ *
+ * The event is written by send() or when it goes out of scope, here at the end of the statement.
+ * In text mode it is one line of JSON, with the timestamp of Logging::setClock(), the level and
+ * the module name of the instance instead of the prefix:
+ *
+ *   {"time":3723004,"level":"INFO","module":"Net","msg":"reading","sensor":3,"temp":21.50,"ok":true}
+ *
+ * In binary mode (Logging::setBinaryMode()) it is an event frame holding a CBOR map, see
+ * ArduinoLogBinary.hpp, which extras/decoder turns back into JSON.
+ *
+ * Fields are rendered as they are added into a line buffer of the event's own, so an event takes
+ * LOG_LINE_BUFFER_SIZE bytes of stack and no other memory. A field that does not fit, in the line
+ * or in binary mode in LOG_BINARY_RECORD_SIZE, is left out whole and the number of those is
+ * written as "dropped" (key 4), so the JSON or CBOR stays well formed. Keys are written as they
+ * are, without escaping.
+ *
+ * At a disabled level add() does nothing, but its arguments are still evaluated.
+ */
+class LogEvent {
+  public:
+    LogEvent(Logging& log, int level, const char* message);
+    LogEvent(Logging& log, int level, const __FlashStringHelper* message);
+    ~LogEvent() { send(); }
+
+    LogEvent(const LogEvent&) = delete;
+    LogEvent& operator=(const LogEvent&) = delete;
+
+    LogEvent& add(const char* key, bool value);
+    LogEvent& add(const char* key, int value) { return add(key, (long) value); }
+    LogEvent& add(const char* key, unsigned int value) { return add(key, (unsigned long) value); }
+    LogEvent& add(const char* key, long value);
+    LogEvent& add(const char* key, unsigned long value);
+    LogEvent& add(const char* key, long long value);
+    LogEvent& add(const char* key, unsigned long long value);
+    // Written with setDigit() decimals as text, as a single precision float in binary mode. Values
+    // that are not finite or beyond +-4294967040 are null in text.
+    LogEvent& add(const char* key, double value);
+    // nullptr is null
+    LogEvent& add(const char* key, const char* value);
+    LogEvent& add(const char* key, const __FlashStringHelper* value);
+
+    // Writes the event; later calls and the destructor do nothing
+    void send();
+
+    bool enabled() const {
+      #ifndef DISABLE_LOGGING
+        return _enabled;
+      #else
+        return false;
+      #endif
+    }
+
+  private:
+    #ifndef DISABLE_LOGGING
+      void begin();
+      void putMessageKey();
+      void putKey(const char* key);
+      // Takes the field written from start back out if the rest would no longer fit
+      void endField(size_t start);
+      void putText(const char* value);
+      void putFlashText(const __FlashStringHelper* value);
+      void appendEscaped(const char* text, size_t size);
+      // CBOR item head: major type and argument, in as few bytes as the argument needs
+      template <class T> void putHead(uint8_t major, T value);
+
+      Logging& _log;
+      LogLine _line;
+      bool _enabled;
+      bool _binary;
+      uint8_t _dropped;
+    #endif
+};
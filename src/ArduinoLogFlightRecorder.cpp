@@ -0,0 +1,443 @@
+#include "ArduinoLog.hpp"
+
+#if LOG_FLIGHT_RECORDER
+
+static const uint32_t kRecorderMagic = 0x4C524543;  // "LREC"
+// Smallest buffer worth recording into
+static const uint16_t kRecorderMinCapacity = 16;
+
+bool LogFlightRecorder::attach(void* memory, size_t size, uint32_t stamp) {
+  uintptr_t address = reinterpret_cast<uintptr_t>(memory);
+  size_t skip = (sizeof(uint32_t) - address % sizeof(uint32_t)) % sizeof(uint32_t);
+  if (memory == nullptr || size < skip + sizeof(Header) + kRecorderMinCapacity) {
+    _header = nullptr;
+    return false;
+  }
+
+  size -= skip + sizeof(Header);
+  uint16_t capacity = size > 0xFFFF ? 0xFFFF : (uint16_t) size;
+  _header = reinterpret_cast<Header*>(address + skip);
+  _data = reinterpret_cast<uint8_t*>(_header + 1);
+
+  bool valid = _header->magic == kRecorderMagic && _header->stamp == stamp &&
+               _header->capacity == capacity && _header->head < capacity && _header->tail < capacity;
+  if (!valid) {
+    _header->magic = kRecorderMagic;
+    _header->stamp = stamp;
+    _header->capacity = capacity;
+    clear();
+  }
+  return valid && _header->head != _header->tail;
+}
+
+void LogFlightRecorder::clear() {
+  _header->head = 0;
+  _header->tail = 0;
+}
+
+// Rotate and xor over the size and the record, so a damaged entry is not rendered
+static uint8_t entryCheck(const uint8_t* record, size_t size) {
+  uint8_t check = (uint8_t) size;
+  for (size_t i = 0; i < size; ++i) {
+    check = (uint8_t) ((check << 1 | check >> 7) ^ record[i]);
+  }
+  return check;
+}
+
+uint16_t LogFlightRecorder::used(uint16_t from) const {
+  uint16_t capacity = _header->capacity;
+  return (uint16_t) ((_header->head + capacity - from) % capacity);
+}
+
+void LogFlightRecorder::push(const uint8_t* record, size_t size) {
+  uint16_t capacity = _header->capacity;
+  // One byte always stays free, so a full buffer does not look empty
+  if (size == 0 || size > 0xFF || size + kEntryOverhead >= capacity)
+    return;
+
+  uint16_t head = _header->head;
+  uint16_t tail = _header->tail;
+  while (capacity - 1u - used(tail) < size + kEntryOverhead) {
+    // A damaged entry longer than what is left empties the buffer
+    uint16_t entry = kEntryOverhead + _data[tail];
+    tail = entry < used(tail) ? (uint16_t) ((tail + entry) % capacity) : head;
+    _header->tail = tail;
+  }
+
+  uint8_t check = entryCheck(record, size);
+  _data[head] = (uint8_t) size;
+  copyIn((head + 1) % capacity, record, size);
+  _data[(head + 1 + size) % capacity] = check;
+  _header->head = (uint16_t) ((head + kEntryOverhead + size) % capacity);
+}
+
+bool LogFlightRecorder::next(uint16_t& position, uint8_t* record, size_t& size) const {
+  uint16_t available = used(position);
+  if (available == 0)
+    return false;
+
+  uint8_t length = _data[position];
+  if (length == 0 || length + kEntryOverhead > available || length > size)
+    return false;
+
+  uint16_t capacity = _header->capacity;
+  copyOut((position + 1) % capacity, record, length);
+  if (_data[(position + 1 + length) % capacity] != entryCheck(record, length))
+    return false;
+  size = length;
+  position = (uint16_t) ((position + kEntryOverhead + length) % capacity);
+  return true;
+}
+
+void LogFlightRecorder::copyIn(uint16_t at, const uint8_t* data, size_t size) {
+  size_t first = _header->capacity - at;
+  if (first > size) {
+    first = size;
+  }
+  memcpy(_data + at, data, first);
+  memcpy(_data, data + first, size - first);
+}
+
+void LogFlightRecorder::copyOut(uint16_t at, uint8_t* data, size_t size) const {
+  size_t first = _header->capacity - at;
+  if (first > size) {
+    first = size;
+  }
+  memcpy(data, _data + at, first);
+  memcpy(data + first, _data, size - first);
+}
+
+#ifndef DISABLE_LOGGING
+
+// Arguments of a stored record, in the encoding of ArduinoLogBinary.hpp
+class LogRecordReader {
+  public:
+    LogRecordReader(const uint8_t* data, size_t size) : _at(data), _end(data + size) {}
+
+    bool get(void* value, size_t size) {
+      if ((size_t) (_end - _at) < size)
+        return false;
+      memcpy(value, _at, size);
+      _at += size;
+      return true;
+    }
+
+    bool get32(uint32_t& value) {
+      uint8_t bytes[4];
+      if (!get(bytes, sizeof(bytes)))
+        return false;
+      value = (uint32_t) bytes[0] | (uint32_t) bytes[1] << 8 | (uint32_t) bytes[2] << 16 | (uint32_t) bytes[3] << 24;
+      return true;
+    }
+
+    // size bytes in place, nullptr if the record was cut inside them
+    const uint8_t* bytes(size_t size) {
+      if ((size_t) (_end - _at) < size)
+        return nullptr;
+      const uint8_t* bytes = _at;
+      _at += size;
+      return bytes;
+    }
+
+    // Zero terminated text, nullptr if the record was cut inside it
+    const char* text() {
+      const uint8_t* end = static_cast<const uint8_t*>(memchr(_at, 0, _end - _at));
+      if (end == nullptr)
+        return nullptr;
+      const char* text = reinterpret_cast<const char*>(_at);
+      _at = end + 1;
+      return text;
+    }
+
+  private:
+    const uint8_t* _at;
+    const uint8_t* _end;
+};
+
+namespace {
+
+  // Format of a Printable logged as the message
+  const char kPrintableFormat[] = "%p";
+  // Only its address is used, see buildStamp()
+  const char kFlashMark[] PROGMEM = "";
+
+  uint32_t addHash(uint32_t hash, const void* data, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+      hash = (hash ^ static_cast<const uint8_t*>(data)[i]) * 16777619UL;
+    }
+    return hash;
+  }
+
+  // FNV-1a hash of the build identification and of the addresses of the library's own code, data
+  // and flash constants. These move with whatever was linked before them, so another firmware
+  // image rarely has the stamp of this one even when it reuses the library objects. A buffer of
+  // another stamp is cleared on attach, before any format address stored in it is read.
+  uint32_t buildStamp() {
+    const uintptr_t addresses[] = {
+      reinterpret_cast<uintptr_t>(&buildStamp),
+      reinterpret_cast<uintptr_t>(kPrintableFormat),
+      reinterpret_cast<uintptr_t>(kFlashMark)
+    };
+    const char* build = LOG_FLIGHT_RECORDER_BUILD;
+    uint32_t hash = addHash(2166136261UL, build, strlen(build));
+    return addHash(hash, addresses, sizeof(addresses));
+  }
+
+  // Length, at most 255, and hash of the first 255 characters of a format
+  uint32_t formatCheck(const char* format, bool flash) {
+    uint32_t hash = 2166136261UL;
+    size_t length = 0;
+    for (; length < 255; ++length) {
+      char c = flash ? pgm_read_byte(format + length) : format[length];
+      if (c == 0)
+        break;
+      hash = (hash ^ (uint8_t) c) * 16777619UL;
+    }
+    return (uint32_t) length << 16 | ((hash ^ hash >> 16) & 0xFFFF);
+  }
+
+  // Integer arguments of the vararg methods are an int, of the LOG_* macros a long
+  bool readSigned(LogRecordReader& in, bool wide, long& value) {
+    if (wide)
+      return in.get(&value, sizeof(value));
+    int narrow;
+    if (!in.get(&narrow, sizeof(narrow)))
+      return false;
+    value = narrow;
+    return true;
+  }
+
+  bool readUnsigned(LogRecordReader& in, bool wide, unsigned long& value) {
+    if (wide)
+      return in.get(&value, sizeof(value));
+    unsigned int narrow;
+    if (!in.get(&narrow, sizeof(narrow)))
+      return false;
+    value = narrow;
+    return true;
+  }
+
+}
+
+#endif
+
+bool Logging::setFlightRecorder(void* memory, size_t size, int level) {
+  #ifndef DISABLE_LOGGING
+    RecordLock lock;
+    bool kept = _recorder.attach(memory, size, buildStamp());
+    _recorderLevel = _recorder.attached() ? level : LOG_LEVEL_SILENT;
+    updateEnabledLevel();
+    return kept;
+  #else
+    return false;
+  #endif
+}
+
+void Logging::clearFlightRecorder() {
+  #ifndef DISABLE_LOGGING
+    RecordLock lock;
+    if (_recorder.attached()) {
+      _recorder.clear();
+    }
+  #endif
+}
+
+size_t Logging::dumpFlightRecorder(Print& output) {
+  size_t count = 0;
+  #ifndef DISABLE_LOGGING
+    RecordLock lock;
+    if (!_recorder.attached())
+      return 0;
+
+    LogLine line;
+    uint8_t record[LOG_BINARY_RECORD_SIZE];
+    size_t size = sizeof(record);
+    for (uint16_t position = _recorder.begin(); _recorder.next(position, record, size); size = sizeof(record)) {
+      printFlightRecord(line, record, size);
+      line.finish();
+      output.write(reinterpret_cast<const uint8_t*>(line.data()), line.length());
+      ++count;
+    }
+  #endif
+  return count;
+}
+
+#ifndef DISABLE_LOGGING
+
+void Logging::recordFlight(int level, const char* format, va_list args) {
+  RecordLock lock;
+  beginFlightRecord(level, format, 0);
+  encodeArguments(_record, format, args);
+  endFlightRecord();
+}
+
+void Logging::recordFlight(int level, const __FlashStringHelper* format, va_list args) {
+  RecordLock lock;
+  beginFlightRecord(level, format, LOG_FORMAT_FLASH);
+  encodeArguments(_record, format, args);
+  endFlightRecord();
+}
+
+void Logging::recordFlight(int level, const Printable& obj, va_list) {
+  RecordLock lock;
+  beginFlightRecord(level, kPrintableFormat, 0);
+  _record.putPrintable(obj);
+  endFlightRecord();
+}
+
+// Record: level, flags, timestamp (uint32, little endian), format address, format length and
+// hash (formatCheck(), 3 bytes), arguments
+void Logging::beginFlightRecord(int level, const void* format, uint8_t flags) {
+  uint32_t check = formatCheck(static_cast<const char*>(format), (flags & LOG_FORMAT_FLASH) != 0);
+  _record.begin(LOG_FRAME_RECORD);
+  _record.put8(level);
+  _record.put8(flags);
+  _record.put32(now());
+  _record.put(&format, sizeof(format));
+  _record.put8((uint8_t) (check >> 16));
+  _record.put8((uint8_t) check);
+  _record.put8((uint8_t) (check >> 8));
+}
+
+void Logging::endFlightRecord() {
+  _record.finish();
+  _recorder.push(_record.payload(), _record.payloadLength());
+}
+
+// Renders a stored record like the log call that wrote it, with its level and time
+void Logging::printFlightRecord(LogLine& out, const uint8_t* record, size_t size) {
+  LogRecordReader in(record, size);
+  uint8_t level = 0;
+  uint8_t flags = 0;
+  uint32_t time = 0;
+  const char* format = nullptr;
+  uint8_t check[3] = {0, 0, 0};
+  in.get(&level, sizeof(level));
+  in.get(&flags, sizeof(flags));
+  in.get32(time);
+  in.get(&format, sizeof(format));
+  in.get(check, sizeof(check));
+
+  out.clear();
+  out.setLevel(level);
+  out.setTime(time);
+  if (_prefixFormat != nullptr) {
+    printPrefixFormat(out);
+  }
+  if (format == nullptr)
+    return;
+
+  bool flash = (flags & LOG_FORMAT_FLASH) != 0;
+  uint32_t expected = (uint32_t) check[0] << 16 | (uint32_t) check[2] << 8 | check[1];
+  if (formatCheck(format, flash) != expected) {
+    out.append("<unknown format>");
+    return;
+  }
+  bool wide = (flags & LOG_FORMAT_WIDE_INTEGERS) != 0;
+  ArduinoLogFormat::Modifiers modifiers;
+  for (char c = flash ? pgm_read_byte(format) : *format; c != 0; c = flash ? pgm_read_byte(format) : *format) {
+    ++format;
+    if (c != '%') {
+      out.append(c);
+      continue;
+    }
+
+    if (flash) {
+      format = ArduinoLogFormat::parseFlashModifiers(format, modifiers);
+      c = pgm_read_byte(format);
+    } else {
+      format = ArduinoLogFormat::parseModifiers(format, modifiers);
+      c = *format;
+    }
+    if (c == 0)
+      break;
+    ++format;
+
+    size_t start = out.length();
+    if (!printRecordArgument(out, c, modifiers.precision, wide, in)) {
+      out.append(LOG_TRUNCATION_MARK);
+      break;
+    }
+    ArduinoLogFormat::applyModifiers(out, start, c, modifiers);
+  }
+}
+
+bool Logging::printRecordArgument(LogLine& out, char format, int precision, bool wide, LogRecordReader& in) {
+  if (format == '%') {
+    out.append(format);
+  }
+  else if (format == 's' || format == 'S' || format == 'p' || format == 'n') {
+    const char* text = in.text();
+    if (text == nullptr)
+      return false;
+    out.append(text);
+  }
+  else if (format == 'h') {
+    uint8_t size;
+    if (!in.get(&size, sizeof(size)))
+      return false;
+    const uint8_t* bytes = in.bytes(size);
+    if (bytes == nullptr)
+      return false;
+    ArduinoLogFormat::printHexBytes(out, bytes, size);
+  }
+  else if (format == 'f' || format == 'D' || format == 'F') {
+    uint8_t digits;
+    double value;
+    if (!in.get(&digits, sizeof(digits)) || !in.get(&value, sizeof(value)))
+      return false;
+    ArduinoLogFormat::printFloat(out, value, digits);
+  }
+  else if (format == 'l' || format == 'd' || format == 'c' || format == 'C' || format == 't' || format == 'T') {
+    long value;
+    if (!readSigned(in, wide || format == 'l', value))
+      return false;
+    if (format == 'c') {
+      ArduinoLogFormat::printChar(out, (char) value);
+    } else if (format == 'C') {
+      ArduinoLogFormat::printCharOrHex(out, (char) value);
+    } else if (format == 't') {
+      ArduinoLogFormat::printBool(out, value == 1);
+    } else if (format == 'T') {
+      ArduinoLogFormat::printBoolWord(out, value == 1);
+    } else {
+      ArduinoLogFormat::printDecimal(out, value);
+    }
+  }
+  else if (format == 'u' || format == 'x' || format == 'X' || format == 'b' || format == 'B') {
+    unsigned long value;
+    if (!readUnsigned(in, wide || format == 'u', value))
+      return false;
+    if (format == 'x') {
+      ArduinoLogFormat::printHex(out, value);
+    } else if (format == 'X') {
+      ArduinoLogFormat::printHexPrefixed(out, value);
+    } else if (format == 'b') {
+      ArduinoLogFormat::printBinary(out, value);
+    } else if (format == 'B') {
+      ArduinoLogFormat::printBinaryPrefixed(out, value);
+    } else {
+      ArduinoLogFormat::printDecimal(out, value);
+    }
+  }
+  else if (format == 'v') {
+    uint8_t level;
+    if (!in.get(&level, sizeof(level)))
+      return false;
+    out.append(getLevelAbbrev(level));
+  }
+  else if (format == 'r') {
+    uint32_t value;
+    if (!in.get32(value))
+      return false;
+    out.appendDecimal((unsigned long) value);
+  }
+  else if (format == 'L' || format == 'm' || format == 'M') {
+    printInternal(out, format);
+  }
+  return true;
+}
+
+#endif  // DISABLE_LOGGING
+
+#endif
@@ -0,0 +1,89 @@
+#pragma once
+#include "Arduino.h"
+
+#include <inttypes.h>
+
+// 1 compiles in the flight recorder, see Logging::setFlightRecorder()
+#ifndef LOG_FLIGHT_RECORDER
+  #define LOG_FLIGHT_RECORDER 0
+#endif
+
+// Identifies the firmware that wrote the records. They hold the addresses of their formats, so
+// records of another build are discarded, before any of those addresses is read, rather than
+// dumped. The stamp also covers where the library's own code and constants were linked, which
+// moves with most changes to the firmware; as the default text only changes when the library
+// itself is compiled again, define it for every firmware version when the build reuses library
+// objects, e.g. -DLOG_FLIGHT_RECORDER_BUILD=\"1.4.2\". Each record also keeps the length and a
+// hash of its format text: one whose format moved in a build with the same stamp is dumped as
+// "<unknown format>", after reading at most 256 bytes at the old address.
+#ifndef LOG_FLIGHT_RECORDER_BUILD
+  #define LOG_FLIGHT_RECORDER_BUILD __DATE__ " " __TIME__
+#endif
+
+// Places a buffer in RAM that is not cleared at startup, where the target has such a section:
+//   static uint8_t trace[1024] LOG_RETAINED;
+// ESP32 uses RTC memory, which also survives deep sleep but holds 8 KB at most. Elsewhere define
+// it for the linker script in use; without it the buffer only keeps records until a reset.
+#ifndef LOG_RETAINED
+  #if defined(ESP32)
+    #define LOG_RETAINED RTC_NOINIT_ATTR
+  #elif defined(__AVR__)
+    #define LOG_RETAINED __attribute__((section(".noinit")))
+  #else
+    #define LOG_RETAINED
+  #endif
+#endif
+
+#if LOG_FLIGHT_RECORDER
+
+class LogRecordReader;
+
+/**
+ * Circular buffer of binary records in memory provided by the application, normally memory that
+ * survives a reset, so that the records written before a watchdog reset can be read after it.
+ *
+ * The memory starts with a header (magic, build stamp, capacity, head and tail offsets), followed
+ * by the entries: a size byte, the record and a check byte, wrapping around the end of the buffer.
+ * When a new entry does not fit, the tail is first moved past the oldest entries, then the entry
+ * is copied and only then published by moving the head, so a reset at any point leaves the buffer
+ * readable. Reading stops at an entry that fails its check or overruns the head, as the memory may
+ * have been damaged by whatever caused the reset.
+ */
+class LogFlightRecorder {
+  public:
+    LogFlightRecorder() : _header(nullptr), _data(nullptr) {}
+
+    // Uses the memory, keeping its records if they were written by this build. True if it did.
+    bool attach(void* memory, size_t size, uint32_t stamp);
+    void detach() { _header = nullptr; }
+    bool attached() const { return _header != nullptr; }
+
+    void push(const uint8_t* record, size_t size);
+    void clear();
+
+    // Position of the oldest entry
+    uint16_t begin() const { return _header->tail; }
+    // Copies the entry at position and advances it. size holds the capacity of record on entry
+    // and the size of the record on return. False at the end or at a damaged entry.
+    bool next(uint16_t& position, uint8_t* record, size_t& size) const;
+
+  private:
+    static const uint8_t kEntryOverhead = 2;
+
+    struct Header {
+      uint32_t magic;
+      uint32_t stamp;
+      uint16_t capacity;
+      volatile uint16_t head;
+      volatile uint16_t tail;
+    };
+
+    uint16_t used(uint16_t from) const;
+    void copyIn(uint16_t at, const uint8_t* data, size_t size);
+    void copyOut(uint16_t at, uint8_t* data, size_t size) const;
+
+    Header* _header;
+    uint8_t* _data;
+};
+
+#endif
@@ -0,0 +1,152 @@
+#include "ArduinoLogFormat.hpp"
+
+namespace ArduinoLogFormat {
+
+  // At least four digits, as many as the value needs beyond that
+  void printHexPrefixed(LogLine& out, unsigned long value) {
+    out.append("0x", 2);
+    out.appendHex(value, 4);
+  }
+
+  void printHexPrefixed(LogLine& out, unsigned long long value) {
+    out.append("0x", 2);
+    out.appendHex(value, 4);
+  }
+
+  void printBinaryPrefixed(LogLine& out, unsigned long value) {
+    out.append("0b", 2);
+    out.appendBinary(value);
+  }
+
+  void printBinaryPrefixed(LogLine& out, unsigned long long value) {
+    out.append("0b", 2);
+    out.appendBinary(value);
+  }
+
+  void printCharOrHex(LogLine& out, char value) {
+    if (value >= 0x20 && value < 0x7F) {
+      out.append(value);
+    } else {
+      out.append("0x", 2);
+      out.appendHex((unsigned long) (uint8_t) value, 2);
+    }
+  }
+
+  void printBool(LogLine& out, bool value) {
+    out.append(value ? 'T' : 'F');
+  }
+
+  void printBoolWord(LogLine& out, bool value) {
+    if (value) {
+      out.appendFlash(F("true"));
+    }
+    else {
+      out.appendFlash(F("false"));
+    }
+  }
+
+  void printFloat(LogLine& out, double value, int digits) {
+    out.appendFloat(value, digits < 0 ? 0 : digits);
+  }
+
+  namespace {
+
+    bool isInteger(char spec) {
+      return spec == 'd' || spec == 'l' || spec == 'u' || spec == 'x' || spec == 'X' ||
+             spec == 'b' || spec == 'B';
+    }
+
+    bool isNumber(char spec) {
+      return isInteger(spec) || spec == 'f' || spec == 'D' || spec == 'F';
+    }
+
+    // Accumulates a width digit, saturating at 255
+    uint8_t addWidthDigit(uint8_t width, char c) {
+      unsigned value = width * 10u + (c - '0');
+      return value > 255 ? 255 : value;
+    }
+
+  }
+
+  const char* parseModifiers(const char* format, Modifiers& modifiers) {
+    modifiers.precision = -1;
+    modifiers.width = 0;
+    modifiers.left = false;
+    modifiers.zero = false;
+    for (;; ++format) {
+      if (*format == '-') modifiers.left = true;
+      else if (*format == '0') modifiers.zero = true;
+      else break;
+    }
+    for (; *format >= '0' && *format <= '9'; ++format) {
+      modifiers.width = addWidthDigit(modifiers.width, *format);
+    }
+    if (*format == '.') {
+      modifiers.precision = 0;
+      for (++format; *format >= '0' && *format <= '9'; ++format) {
+        modifiers.precision = modifiers.precision * 10 + (*format - '0');
+      }
+    }
+    return format;
+  }
+
+  PGM_P parseFlashModifiers(PGM_P format, Modifiers& modifiers) {
+    modifiers.precision = -1;
+    modifiers.width = 0;
+    modifiers.left = false;
+    modifiers.zero = false;
+    char c = pgm_read_byte(format);
+    for (;; c = pgm_read_byte(++format)) {
+      if (c == '-') modifiers.left = true;
+      else if (c == '0') modifiers.zero = true;
+      else break;
+    }
+    for (; c >= '0' && c <= '9'; c = pgm_read_byte(++format)) {
+      modifiers.width = addWidthDigit(modifiers.width, c);
+    }
+    if (c == '.') {
+      modifiers.precision = 0;
+      for (c = pgm_read_byte(++format); c >= '0' && c <= '9'; c = pgm_read_byte(++format)) {
+        modifiers.precision = modifiers.precision * 10 + (c - '0');
+      }
+    }
+    return format;
+  }
+
+  // Works on the text in place: zeros are inserted after the sign or prefix, spaces in front of
+  // or after the text. nan and inf are padded with spaces.
+  void padArgument(LogLine& out, size_t start, char spec, const Modifiers& modifiers) {
+    size_t length = out.length() - start;
+    const char* text = out.data() + start;
+    size_t lead = 0;
+    if (length > 0 && text[0] == '-') {
+      lead = 1;
+    } else if ((spec == 'X' || spec == 'B') && length > 2) {
+      lead = 2;
+    }
+
+    bool integer = isInteger(spec);
+    if (modifiers.precision >= 0) {
+      size_t precision = modifiers.precision;
+      if (integer) {
+        if (length - lead < precision) {
+          out.insertFill(start + lead, '0', precision - (length - lead));
+        }
+      } else if (!isNumber(spec) && length > precision) {
+        out.rewind(start + precision);
+      }
+      length = out.length() - start;
+    }
+
+    if (length >= modifiers.width) return;
+    size_t fill = modifiers.width - length;
+    if (modifiers.left) {
+      out.appendFill(' ', fill);
+    } else if (modifiers.zero && (integer ? modifiers.precision < 0 : isNumber(spec) && isDigit(text[lead]))) {
+      out.insertFill(start + lead, '0', fill);
+    } else {
+      out.insertFill(start, ' ', fill);
+    }
+  }
+
+}
@@ -0,0 +1,684 @@
+#pragma once
+#include "ArduinoLog.hpp"
+
+/**
+ * Compile-time front end for string literal formats, used by the LOG_CRITICAL() ... LOG_TRACE()
+ * macros.
+ *
+ * The literal is split at compile time into literal spans, written with one append each, and
+ * specifiers, each bound to the argument it consumes. Arguments keep their C++ type instead of
+ * going through C varargs, and a specifier that does not match its argument, an unknown
+ * specifier or a wrong number of arguments is a compile error.
+ *
+ * Formats that are not string literals (F() strings, variables) go through the Logging methods,
+ * which parse the format at runtime.
+ */
+namespace ArduinoLogFormat {
+
+  // ---- Renderers shared by the runtime and the compile-time formatter, one per specifier
+
+  // Integers arrive as the widest of long and their own type. Hexadecimal and binary take the
+  // value as unsigned in the width of the argument, so negative values show as two's complement
+  // of that width.
+  inline void printDecimal(LogLine& out, long value) { out.appendDecimal(value); }
+  inline void printDecimal(LogLine& out, long long value) { out.appendDecimal(value); }
+  inline void printDecimal(LogLine& out, unsigned long value) { out.appendDecimal(value); }
+  inline void printDecimal(LogLine& out, unsigned long long value) { out.appendDecimal(value); }
+  inline void printHex(LogLine& out, unsigned long value) { out.appendHex(value); }
+  inline void printHex(LogLine& out, unsigned long long value) { out.appendHex(value); }
+  void printHexPrefixed(LogLine& out, unsigned long value);
+  void printHexPrefixed(LogLine& out, unsigned long long value);
+  inline void printBinary(LogLine& out, unsigned long value) { out.appendBinary(value); }
+  inline void printBinary(LogLine& out, unsigned long long value) { out.appendBinary(value); }
+  void printBinaryPrefixed(LogLine& out, unsigned long value);
+  void printBinaryPrefixed(LogLine& out, unsigned long long value);
+  void printCharOrHex(LogLine& out, char value);
+  void printBool(LogLine& out, bool value);
+  void printBoolWord(LogLine& out, bool value);
+  void printFloat(LogLine& out, double value, int digits);
+
+  // Runtime parsing of the modifiers. Return the position of the conversion character.
+  const char* parseModifiers(const char* format, Modifiers& modifiers);
+  PGM_P parseFlashModifiers(PGM_P format, Modifiers& modifiers);
+
+  // Applies the modifiers to the text the specifier spec rendered from start on. The precision
+  // of integers is a minimum number of digits, of %f, %D and %F the decimals (already applied by
+  // the renderer) and of all others a maximum number of characters. Padding goes to the width
+  // with spaces, or for numbers with the '0' flag with zeros after the sign or 0x/0b prefix.
+  void padArgument(LogLine& out, size_t start, char spec, const Modifiers& modifiers);
+  inline void applyModifiers(LogLine& out, size_t start, char spec, const Modifiers& modifiers) {
+    if (modifiers.width > 0 || modifiers.precision >= 0) padArgument(out, start, spec, modifiers);
+  }
+
+  inline void printChar(LogLine& out, char value) { out.append(value); }
+  inline void printString(LogLine& out, const char* value) { out.append(value); }
+  inline void printFlashString(LogLine& out, const __FlashStringHelper* value) { out.appendFlash(value); }
+  inline void printPrintable(LogLine& out, const Printable& value) { value.printTo(out); }
+  inline void printPrintable(LogLine& out, const Printable* value) { if (value != nullptr) value->printTo(out); }
+  inline void printHexBytes(LogLine& out, const void* data, size_t size) {
+    out.appendHexBytes(static_cast<const uint8_t*>(data), size);
+  }
+  // Length argument of %h, where a negative length is 0
+  template <typename T> inline size_t byteCount(T size) {
+    return size > 0 ? static_cast<size_t>(size) : 0;
+  }
+
+  // ---- Argument classification
+
+  enum ArgKind {
+    ARG_OTHER,
+    ARG_INTEGER,
+    ARG_FLOAT,
+    ARG_STRING,
+    ARG_FLASH_STRING,
+    ARG_PRINTABLE,
+    ARG_POINTER
+  };
+
+  template <class T> struct IsPrintable {
+    static char check(const Printable*);
+    static long check(...);
+    static const bool value = sizeof(check(static_cast<T*>(nullptr))) == sizeof(char);
+  };
+
+  template <class T> struct Kind { static const ArgKind value = IsPrintable<T>::value ? ARG_PRINTABLE : ARG_OTHER; };
+  template <class T> struct Kind<volatile T> : Kind<T> {};
+  template <class T, size_t N> struct Kind<T[N]> : Kind<T*> {};
+  template <class T> struct Kind<T*> { static const ArgKind value = IsPrintable<T>::value ? ARG_PRINTABLE : ARG_POINTER; };
+
+  template <> struct Kind<bool>               { static const ArgKind value = ARG_INTEGER; };
+  template <> struct Kind<char>               { static const ArgKind value = ARG_INTEGER; };
+  template <> struct Kind<signed char>        { static const ArgKind value = ARG_INTEGER; };
+  template <> struct Kind<unsigned char>      { static const ArgKind value = ARG_INTEGER; };
+  template <> struct Kind<short>              { static const ArgKind value = ARG_INTEGER; };
+  template <> struct Kind<unsigned short>     { static const ArgKind value = ARG_INTEGER; };
+  template <> struct Kind<int>                { static const ArgKind value = ARG_INTEGER; };
+  template <> struct Kind<unsigned int>       { static const ArgKind value = ARG_INTEGER; };
+  template <> struct Kind<long>               { static const ArgKind value = ARG_INTEGER; };
+  template <> struct Kind<unsigned long>      { static const ArgKind value = ARG_INTEGER; };
+  template <> struct Kind<long long>          { static const ArgKind value = ARG_INTEGER; };
+  template <> struct Kind<unsigned long long> { static const ArgKind value = ARG_INTEGER; };
+  template <> struct Kind<float>              { static const ArgKind value = ARG_FLOAT; };
+  template <> struct Kind<double>             { static const ArgKind value = ARG_FLOAT; };
+  template <> struct Kind<char*>              { static const ArgKind value = ARG_STRING; };
+  template <> struct Kind<const char*>        { static const ArgKind value = ARG_STRING; };
+  template <> struct Kind<__FlashStringHelper*>       { static const ArgKind value = ARG_FLASH_STRING; };
+  template <> struct Kind<const __FlashStringHelper*> { static const ArgKind value = ARG_FLASH_STRING; };
+
+  // Enumerations are passed on as their underlying integer, as the vararg methods take them.
+  // Compiler builtins, as avr-gcc has no <type_traits>.
+  template <class T, bool Enum = __is_enum(T)> struct Promoted {
+    typedef T type;
+    static const T& get(const T& value) { return value; }
+  };
+  template <class T> struct Promoted<T, true> {
+    typedef __underlying_type(T) type;
+    static type get(const T& value) { return static_cast<type>(value); }
+  };
+
+  // ---- Integer widening
+
+  template <class T> struct IsSigned { static const bool value = T(-1) < T(0); };
+
+  // Unsigned type of the same width
+  template <class T> struct Unsigned { typedef T type; };
+  template <> struct Unsigned<char>        { typedef unsigned char type; };
+  template <> struct Unsigned<signed char> { typedef unsigned char type; };
+  template <> struct Unsigned<short>       { typedef unsigned short type; };
+  template <> struct Unsigned<int>         { typedef unsigned int type; };
+  template <> struct Unsigned<long>        { typedef unsigned long type; };
+  template <> struct Unsigned<long long>   { typedef unsigned long long type; };
+  template <class T> struct Unsigned<volatile T> : Unsigned<T> {};
+
+  // Type a renderer takes an integer argument as: the widest of long and T, keeping its sign
+  template <class T, bool Signed = IsSigned<T>::value, bool Wide = (sizeof(T) > sizeof(long))> struct Widened;
+  template <class T> struct Widened<T, true, false>  { typedef long type; };
+  template <class T> struct Widened<T, true, true>   { typedef long long type; };
+  template <class T> struct Widened<T, false, false> { typedef unsigned long type; };
+  template <class T> struct Widened<T, false, true>  { typedef unsigned long long type; };
+
+  template <class T> typename Widened<T>::type widen(T value) {
+    return static_cast<typename Widened<T>::type>(value);
+  }
+
+  template <class T> typename Widened<typename Unsigned<T>::type>::type widenUnsigned(T value) {
+    return widen(static_cast<typename Unsigned<T>::type>(value));
+  }
+
+  // ---- Compile-time parsing
+
+  // Index of the next '%' at or after pos, or of the terminating zero.
+  constexpr unsigned nextSpecifier(const char* format, unsigned pos) {
+    return (format[pos] == '\0' || format[pos] == '%') ? pos : nextSpecifier(format, pos + 1);
+  }
+
+  constexpr bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+  }
+
+  // Index of the first character at or after pos that is not a digit
+  constexpr unsigned skipDigits(const char* format, unsigned pos) {
+    return isDigit(format[pos]) ? skipDigits(format, pos + 1) : pos;
+  }
+
+  // Value of the digits starting at pos, accumulated onto value
+  constexpr int digitsValue(const char* format, unsigned pos, int value) {
+    return isDigit(format[pos]) ? digitsValue(format, pos + 1, value * 10 + (format[pos] - '0')) : value;
+  }
+
+  constexpr bool isFlag(char c) {
+    return c == '-' || c == '0';
+  }
+
+  // Index of the first character at or after pos that is not a flag
+  constexpr unsigned skipFlags(const char* format, unsigned pos) {
+    return isFlag(format[pos]) ? skipFlags(format, pos + 1) : pos;
+  }
+
+  // Whether the flags starting at pos include flag
+  constexpr bool hasFlag(const char* format, unsigned pos, char flag) {
+    return isFlag(format[pos]) && (format[pos] == flag || hasFlag(format, pos + 1, flag));
+  }
+
+  // Index of the '.' or conversion character after the flags and width of the specifier at pos
+  constexpr unsigned widthEnd(const char* format, unsigned pos) {
+    return skipDigits(format, skipFlags(format, pos + 1));
+  }
+
+  // Index of the conversion character of the specifier at pos, after optional flags, width and
+  // ".precision"
+  constexpr unsigned conversionAt(const char* format, unsigned pos) {
+    return format[widthEnd(format, pos)] == '.' ? skipDigits(format, widthEnd(format, pos) + 1)
+                                                : widthEnd(format, pos);
+  }
+
+  // Conversion character of the specifier at pos, or zero at the end of the format.
+  constexpr char specifierAt(const char* format, unsigned pos) {
+    return format[pos] == '\0' ? '\0' : format[conversionAt(format, pos)];
+  }
+
+  // Precision of the specifier at pos, -1 if it has none
+  constexpr int precisionAt(const char* format, unsigned pos) {
+    return format[pos] != '\0' && format[widthEnd(format, pos)] == '.'
+             ? digitsValue(format, widthEnd(format, pos) + 1, 0) : -1;
+  }
+
+  // Width of the specifier at pos, 0 if it has none
+  constexpr int widthAt(const char* format, unsigned pos) {
+    return format[pos] == '\0' ? 0 : digitsValue(format, skipFlags(format, pos + 1), 0);
+  }
+
+  constexpr bool isFloat(char spec) {
+    return spec == 'f' || spec == 'D' || spec == 'F';
+  }
+
+  constexpr bool isInternal(char spec) {
+    return spec == 'L' || spec == 'v' || spec == 'n' || spec == 'm' || spec == 'M' || spec == 'r';
+  }
+
+  constexpr bool accepts(char spec, ArgKind kind) {
+    return (spec == 'd' || spec == 'l' || spec == 'u' || spec == 'x' || spec == 'X' ||
+            spec == 'b' || spec == 'B' || spec == 'c' || spec == 'C' || spec == 't' || spec == 'T')
+             ? kind == ARG_INTEGER
+         : isFloat(spec) ? (kind == ARG_FLOAT || kind == ARG_INTEGER)
+         : spec == 's' ? kind == ARG_STRING
+         : spec == 'S' ? (kind == ARG_FLASH_STRING || kind == ARG_STRING)
+         : spec == 'p' ? kind == ARG_PRINTABLE
+         : false;
+  }
+
+  // Access to the Logging internals the emitters need
+  struct Access {
+    static int digit() {
+      #ifndef DISABLE_LOGGING
+        return Logging::_digit;
+      #else
+        return 0;
+      #endif
+    }
+
+    static void encodeInternal(Logging& log, LogRecord& out, char spec) { log.encodeInternal(out, spec); }
+  };
+
+  // ---- Typed emitters, one per argument-consuming specifier
+
+  template <char Spec> struct Emit { static const bool known = false; };
+
+  template <> struct Emit<'d'> {
+    static const bool known = true;
+    template <class T> static void print(Logging&, LogLine& out, const T& value, int) { printDecimal(out, widen(value)); }
+  };
+  template <> struct Emit<'l'> : Emit<'d'> {};
+  template <> struct Emit<'u'> {
+    static const bool known = true;
+    template <class T> static void print(Logging&, LogLine& out, const T& value, int) { printDecimal(out, widenUnsigned(value)); }
+  };
+  template <> struct Emit<'x'> {
+    static const bool known = true;
+    template <class T> static void print(Logging&, LogLine& out, const T& value, int) { printHex(out, widenUnsigned(value)); }
+  };
+  template <> struct Emit<'X'> {
+    static const bool known = true;
+    template <class T> static void print(Logging&, LogLine& out, const T& value, int) { printHexPrefixed(out, widenUnsigned(value)); }
+  };
+  template <> struct Emit<'b'> {
+    static const bool known = true;
+    template <class T> static void print(Logging&, LogLine& out, const T& value, int) { printBinary(out, widenUnsigned(value)); }
+  };
+  template <> struct Emit<'B'> {
+    static const bool known = true;
+    template <class T> static void print(Logging&, LogLine& out, const T& value, int) { printBinaryPrefixed(out, widenUnsigned(value)); }
+  };
+  template <> struct Emit<'c'> {
+    static const bool known = true;
+    template <class T> static void print(Logging&, LogLine& out, const T& value, int) { printChar(out, static_cast<char>(value)); }
+  };
+  template <> struct Emit<'C'> {
+    static const bool known = true;
+    template <class T> static void print(Logging&, LogLine& out, const T& value, int) { printCharOrHex(out, static_cast<char>(value)); }
+  };
+  template <> struct Emit<'t'> {
+    static const bool known = true;
+    template <class T> static void print(Logging&, LogLine& out, const T& value, int) { printBool(out, value == 1); }
+  };
+  template <> struct Emit<'T'> {
+    static const bool known = true;
+    template <class T> static void print(Logging&, LogLine& out, const T& value, int) { printBoolWord(out, value == 1); }
+  };
+  template <> struct Emit<'f'> {
+    static const bool known = true;
+    template <class T> static void print(Logging&, LogLine& out, const T& value, int precision) {
+      printFloat(out, static_cast<double>(value), precision >= 0 ? precision : Access::digit());
+    }
+  };
+  template <> struct Emit<'D'> : Emit<'f'> {};
+  template <> struct Emit<'F'> : Emit<'f'> {};
+  template <> struct Emit<'s'> {
+    static const bool known = true;
+    static void print(Logging&, LogLine& out, const char* value, int) { printString(out, value); }
+  };
+  template <> struct Emit<'S'> {
+    static const bool known = true;
+    static void print(Logging&, LogLine& out, const __FlashStringHelper* value, int) { printFlashString(out, value); }
+    static void print(Logging&, LogLine& out, const char* value, int) {
+      printFlashString(out, reinterpret_cast<const __FlashStringHelper*>(value));
+    }
+  };
+  template <> struct Emit<'p'> {
+    static const bool known = true;
+    static void print(Logging&, LogLine& out, const Printable& value, int) { printPrintable(out, value); }
+    static void print(Logging&, LogLine& out, const Printable* value, int) { printPrintable(out, value); }
+  };
+
+  // ---- Binary encoders, see ArduinoLogBinary.hpp. Integer specifiers are widened to long.
+
+  template <char Spec> struct Encode {
+    template <class T> static void put(LogRecord& out, const T& value, int) {
+      long wide = static_cast<long>(value);
+      out.put(&wide, sizeof(wide));
+    }
+  };
+  // Unsigned in the width of the argument, like the text renderers
+  struct EncodeUnsigned {
+    template <class T> static void put(LogRecord& out, const T& value, int) {
+      unsigned long wide = static_cast<unsigned long>(widenUnsigned(value));
+      out.put(&wide, sizeof(wide));
+    }
+  };
+  template <> struct Encode<'u'> : EncodeUnsigned {};
+  template <> struct Encode<'x'> : EncodeUnsigned {};
+  template <> struct Encode<'X'> : EncodeUnsigned {};
+  template <> struct Encode<'b'> : EncodeUnsigned {};
+  template <> struct Encode<'B'> : EncodeUnsigned {};
+  template <> struct Encode<'f'> {
+    template <class T> static void put(LogRecord& out, const T& value, int precision) {
+      double wide = static_cast<double>(value);
+      out.put8(precision >= 0 ? precision : Access::digit());
+      out.put(&wide, sizeof(wide));
+    }
+  };
+  template <> struct Encode<'D'> : Encode<'f'> {};
+  template <> struct Encode<'F'> : Encode<'f'> {};
+  template <> struct Encode<'s'> {
+    static void put(LogRecord& out, const char* value, int) { out.putString(value); }
+  };
+  template <> struct Encode<'S'> {
+    static void put(LogRecord& out, const __FlashStringHelper* value, int) { out.putFlashString(value); }
+    static void put(LogRecord& out, const char* value, int) {
+      out.putFlashString(reinterpret_cast<const __FlashStringHelper*>(value));
+    }
+  };
+  template <> struct Encode<'p'> {
+    static void put(LogRecord& out, const Printable& value, int) { out.putPrintable(value); }
+    static void put(LogRecord& out, const Printable* value, int) {
+      if (value != nullptr) out.putPrintable(*value); else out.put8(0);
+    }
+  };
+
+  // ---- Output policies: text is rendered into a LogLine, binary records only keep the arguments
+
+  inline void emitLiteral(LogLine& out, const char* text, size_t size) { out.append(text, size); }
+  inline void emitLiteral(LogRecord&, const char*, size_t) {}
+
+  // Modifiers other than the precision of floats are applied to the text; binary records leave
+  // them to the decoder, which finds them in the format.
+  inline void emitInternal(Logging& log, LogLine& out, char spec, const Modifiers& modifiers) {
+    size_t start = out.length();
+    if (spec == '%') out.append('%'); else log.printInternal(out, spec);
+    applyModifiers(out, start, spec, modifiers);
+  }
+  inline void emitInternal(Logging& log, LogRecord& out, char spec, const Modifiers&) {
+    if (spec != '%') Access::encodeInternal(log, out, spec);
+  }
+
+  template <char Spec, class T>
+  void emitArgument(Logging& log, LogLine& out, const T& value, const Modifiers& modifiers) {
+    size_t start = out.length();
+    Emit<Spec>::print(log, out, value, modifiers.precision);
+    applyModifiers(out, start, Spec, modifiers);
+  }
+  template <char Spec, class T>
+  void emitArgument(Logging&, LogRecord& out, const T& value, const Modifiers& modifiers) {
+    Encode<Spec>::put(out, value, modifiers.precision);
+  }
+
+  // %h, the one specifier with two arguments
+  inline void emitBytes(LogLine& out, const void* data, size_t size, const Modifiers& modifiers) {
+    size_t start = out.length();
+    printHexBytes(out, data, size);
+    applyModifiers(out, start, 'h', modifiers);
+  }
+  inline void emitBytes(LogRecord& out, const void* data, size_t size, const Modifiers&) {
+    out.putBytes(data, size);
+  }
+
+  // ---- Format walker
+
+  template <class Format, unsigned Pos> struct Span;
+
+  // Modifiers of the specifier at Pos, folded into constants where they are used
+  template <class Format, unsigned Pos> struct ModifiersAt {
+    static_assert(widthAt(Format::str(), Pos) <= 255, "ArduinoLog: width is at most 255");
+
+    static Modifiers get() {
+      Modifiers modifiers = {
+        precisionAt(Format::str(), Pos),
+        static_cast<uint8_t>(widthAt(Format::str(), Pos)),
+        hasFlag(Format::str(), Pos + 1, '-'),
+        hasFlag(Format::str(), Pos + 1, '0')
+      };
+      return modifiers;
+    }
+  };
+
+  // Handles the specifier at Pos (the '%'), Spec being the character after it.
+  template <class Format, unsigned Pos, char Spec> struct Step {
+    static constexpr unsigned Next = conversionAt(Format::str(), Pos) + 1;
+
+    template <class Out, typename T, typename... Rest>
+    static void print(Logging& log, Out& out, const T& value, const Rest&... rest) {
+      static_assert(Emit<Spec>::known || isInternal(Spec), "ArduinoLog: unknown format specifier");
+      static_assert(accepts(Spec, Kind<typename Promoted<T>::type>::value),
+                    "ArduinoLog: argument type does not match format specifier");
+      emitArgument<Spec>(log, out, Promoted<T>::get(value), ModifiersAt<Format, Pos>::get());
+      Span<Format, Next>::print(log, out, rest...);
+    }
+
+    template <class Out>
+    static void print(Logging&, Out&) {
+      static_assert(Spec != Spec, "ArduinoLog: not enough arguments for format string");
+    }
+  };
+
+  template <class Format, unsigned Pos> struct Step<Format, Pos, '\0'> {
+    template <class Out, typename... Args>
+    static void print(Logging&, Out&, const Args&...) {
+      static_assert(sizeof...(Args) == 0, "ArduinoLog: too many arguments for format string");
+    }
+  };
+
+  // A pointer, then an integer length
+  template <class Format, unsigned Pos> struct Step<Format, Pos, 'h'> {
+    template <class Out, typename T, typename Size, typename... Rest>
+    static void print(Logging& log, Out& out, const T& data, const Size& size, const Rest&... rest) {
+      static_assert(Kind<T>::value == ARG_POINTER || Kind<T>::value == ARG_STRING,
+                    "ArduinoLog: %h takes a pointer and a length");
+      static_assert(Kind<typename Promoted<Size>::type>::value == ARG_INTEGER,
+                    "ArduinoLog: %h takes a pointer and a length");
+      emitBytes(out, data, byteCount(Promoted<Size>::get(size)), ModifiersAt<Format, Pos>::get());
+      Span<Format, conversionAt(Format::str(), Pos) + 1>::print(log, out, rest...);
+    }
+
+    template <class Out, typename... Args>
+    static void print(Logging&, Out&, const Args&...) {
+      static_assert(sizeof...(Args) != sizeof...(Args), "ArduinoLog: not enough arguments for format string");
+    }
+  };
+
+  // Internal variables and %% don't consume arguments.
+  template <class Format, unsigned Pos, char Spec> struct InternalStep {
+    template <class Out, typename... Args>
+    static void print(Logging& log, Out& out, const Args&... args) {
+      emitInternal(log, out, Spec, ModifiersAt<Format, Pos>::get());
+      Span<Format, conversionAt(Format::str(), Pos) + 1>::print(log, out, args...);
+    }
+  };
+
+  template <class Format, unsigned Pos> struct Step<Format, Pos, '%'> : InternalStep<Format, Pos, '%'> {};
+
+  template <class Format, unsigned Pos> struct Step<Format, Pos, 'L'> : InternalStep<Format, Pos, 'L'> {};
+  template <class Format, unsigned Pos> struct Step<Format, Pos, 'v'> : InternalStep<Format, Pos, 'v'> {};
+  template <class Format, unsigned Pos> struct Step<Format, Pos, 'n'> : InternalStep<Format, Pos, 'n'> {};
+  template <class Format, unsigned Pos> struct Step<Format, Pos, 'm'> : InternalStep<Format, Pos, 'm'> {};
+  template <class Format, unsigned Pos> struct Step<Format, Pos, 'M'> : InternalStep<Format, Pos, 'M'> {};
+  template <class Format, unsigned Pos> struct Step<Format, Pos, 'r'> : InternalStep<Format, Pos, 'r'> {};
+
+  // Writes the literal text from Pos up to the next specifier, then handles that specifier.
+  template <class Format, unsigned Pos> struct Span {
+    static constexpr unsigned End = nextSpecifier(Format::str(), Pos);
+    static constexpr char Spec = specifierAt(Format::str(), End);
+
+    template <class Out, typename... Args>
+    static void print(Logging& log, Out& out, const Args&... args) {
+      if (End > Pos) {
+        emitLiteral(out, Format::str() + Pos, End - Pos);
+      }
+      Step<Format, End, Spec>::print(log, out, args...);
+    }
+  };
+
+  // ---- Entry of a format, with its arguments passed by address
+
+  template <unsigned... I> struct Indices {};
+  template <unsigned N, unsigned... I> struct MakeIndices : MakeIndices<N - 1, N - 1, I...> {};
+  template <unsigned... I> struct MakeIndices<0, I...> { typedef Indices<I...> type; };
+
+  // One instance per format and argument types; Logging::printCompiledLine() does the rest.
+  template <class Format, typename... Args> struct Compiled {
+    template <class Out> static void emit(Logging& log, Out& out, const void* const* args) {
+      emitAt(log, out, args, typename MakeIndices<sizeof...(Args)>::type());
+    }
+
+    template <class Out, unsigned... I>
+    static void emitAt(Logging& log, Out& out, const void* const* args, Indices<I...>) {
+      Span<Format, 0>::print(log, out, *static_cast<const Args*>(args[I])...);
+    }
+  };
+
+}
+
+template <class Format, typename... Args>
+void Logging::printCompiled(int level, const Args&... args) {
+  #ifndef DISABLE_LOGGING
+    const void* const argv[] = { (const void*) &args..., nullptr };
+    printCompiledLine(level, 0, Format::str(),
+                      &ArduinoLogFormat::Compiled<Format, Args...>::template emit<LogLine>,
+                      &ArduinoLogFormat::Compiled<Format, Args...>::template emit<LogRecord>, argv);
+  #endif
+}
+
+template <class Format, typename... Args>
+void Logging::printLimited(int level, LogLimiter& limiter, const Args&... args) {
+  #ifndef DISABLE_LOGGING
+    const void* const argv[] = { (const void*) &args..., nullptr };
+    printCompiledLine(level, limiter.takeSuppressed(), Format::str(),
+                      &ArduinoLogFormat::Compiled<Format, Args...>::template emit<LogLine>,
+                      &ArduinoLogFormat::Compiled<Format, Args...>::template emit<LogRecord>, argv);
+  #endif
+}
+
+/**
+ * Logs a string literal format parsed at compile time, e.g.
+ *
+ *   LOG_INFO(Log, "Temperature %d at %s", readTemperature(), "sensor");
+ *
+ * The level is checked before the arguments are evaluated, so a disabled level costs one compare
+ * and readTemperature() is not called. For F() and other runtime formats the same is achieved with
+ *
+ *   if (Log.isEnabled(LOG_LEVEL_INFO)) Log.info(F("Temperature %d"), readTemperature());
+ */
+#define LOG_PRINT(logger, level, format, ...)                                     \
+  do {                                                                            \
+    if ((logger).shouldLog(level)) {                                              \
+      struct LogFormat_ { static constexpr const char* str() { return format; } }; \
+      (logger).printCompiled<LogFormat_>(level, ##__VA_ARGS__);                   \
+    }                                                                             \
+  } while (0)
+
+/**
+ * Like LOG_PRINT(), but at most burst messages at once and then one per interval milliseconds pass
+ * from this call site, e.g.
+ *
+ *   LOG_WARNING_LIMITED(Log, 1000, 5, "Sensor %d not responding", id);
+ *
+ * A suppressed message costs a token bucket update and no formatting. The next message that passes
+ * ends with " (N suppressed)". interval and burst must be constants.
+ */
+#define LOG_PRINT_LIMITED(logger, level, interval, burst, format, ...)            \
+  do {                                                                            \
+    if ((logger).shouldLog(level)) {                                              \
+      static LogLimiter limiter_(interval, burst);                                \
+      if ((logger).admit(limiter_)) {                                             \
+        struct LogFormat_ { static constexpr const char* str() { return format; } }; \
+        (logger).printLimited<LogFormat_>(level, limiter_, ##__VA_ARGS__);        \
+      }                                                                           \
+    }                                                                             \
+  } while (0)
+
+/**
+ * Sampling for hot loops: LOG_PRINT_EVERY() writes the first message of its call site and then
+ * every nth, LOG_PRINT_SAMPLED() each message with the given probability, e.g.
+ *
+ *   LOG_DEBUG_EVERY(Log, 100, "Sample %d", adc);
+ *   LOG_DEBUG_SAMPLED(Log, 0.01, "Sample %d", adc);
+ *
+ * A message that is not taken costs a counter or random number update, and neither its arguments
+ * nor the prefix are evaluated. n and probability must be constants.
+ */
+#define LOG_PRINT_EVERY(logger, level, n, format, ...)                            \
+  do {                                                                            \
+    static LogEvery every_(n);                                                    \
+    if ((logger).shouldLog(level) && every_.admit()) {                            \
+      struct LogFormat_ { static constexpr const char* str() { return format; } }; \
+      (logger).printCompiled<LogFormat_>(level, ##__VA_ARGS__);                   \
+    }                                                                             \
+  } while (0)
+
+#define LOG_PRINT_SAMPLED(logger, level, probability, format, ...)                \
+  do {                                                                            \
+    static constexpr uint32_t threshold_ = Logging::sampleThreshold(probability); \
+    if ((logger).shouldLog(level) && Logging::sampled(threshold_)) {              \
+      struct LogFormat_ { static constexpr const char* str() { return format; } }; \
+      (logger).printCompiled<LogFormat_>(level, ##__VA_ARGS__);                   \
+    }                                                                             \
+  } while (0)
+
+// Levels above LOG_LEVEL_MAX expand to nothing: no code, format literal or argument evaluation.
+// Unlike the Logging methods, which are shared inline code and need LOG_LEVEL_MAX to be the same
+// in the whole project, the macros honour a LOG_LEVEL_MAX defined by a single translation unit
+// before its first include of ArduinoLog.hpp.
+#define LOG_DISCARD(logger, ...) do {} while (0)
+
+#if LOG_LEVEL_MAX >= LOG_LEVEL_CRITICAL
+  #define LOG_CRITICAL(logger, ...) LOG_PRINT(logger, LOG_LEVEL_CRITICAL, __VA_ARGS__)
+  #define LOG_CRITICAL_LIMITED(logger, interval, burst, ...) \
+    LOG_PRINT_LIMITED(logger, LOG_LEVEL_CRITICAL, interval, burst, __VA_ARGS__)
+  #define LOG_CRITICAL_EVERY(logger, n, ...) LOG_PRINT_EVERY(logger, LOG_LEVEL_CRITICAL, n, __VA_ARGS__)
+  #define LOG_CRITICAL_SAMPLED(logger, probability, ...) \
+    LOG_PRINT_SAMPLED(logger, LOG_LEVEL_CRITICAL, probability, __VA_ARGS__)
+#else
+  #define LOG_CRITICAL(logger, ...) LOG_DISCARD(logger, __VA_ARGS__)
+  #define LOG_CRITICAL_LIMITED(logger, interval, burst, ...) LOG_DISCARD(logger, __VA_ARGS__)
+  #define LOG_CRITICAL_EVERY(logger, n, ...) LOG_DISCARD(logger, __VA_ARGS__)
+  #define LOG_CRITICAL_SAMPLED(logger, probability, ...) LOG_DISCARD(logger, __VA_ARGS__)
+#endif
+
+#if LOG_LEVEL_MAX >= LOG_LEVEL_ERROR
+  #define LOG_ERROR(logger, ...) LOG_PRINT(logger, LOG_LEVEL_ERROR, __VA_ARGS__)
+  #define LOG_ERROR_LIMITED(logger, interval, burst, ...) \
+    LOG_PRINT_LIMITED(logger, LOG_LEVEL_ERROR, interval, burst, __VA_ARGS__)
+  #define LOG_ERROR_EVERY(logger, n, ...) LOG_PRINT_EVERY(logger, LOG_LEVEL_ERROR, n, __VA_ARGS__)
+  #define LOG_ERROR_SAMPLED(logger, probability, ...) \
+    LOG_PRINT_SAMPLED(logger, LOG_LEVEL_ERROR, probability, __VA_ARGS__)
+#else
+  #define LOG_ERROR(logger, ...) LOG_DISCARD(logger, __VA_ARGS__)
+  #define LOG_ERROR_LIMITED(logger, interval, burst, ...) LOG_DISCARD(logger, __VA_ARGS__)
+  #define LOG_ERROR_EVERY(logger, n, ...) LOG_DISCARD(logger, __VA_ARGS__)
+  #define LOG_ERROR_SAMPLED(logger, probability, ...) LOG_DISCARD(logger, __VA_ARGS__)
+#endif
+
+#if LOG_LEVEL_MAX >= LOG_LEVEL_WARNING
+  #define LOG_WARNING(logger, ...) LOG_PRINT(logger, LOG_LEVEL_WARNING, __VA_ARGS__)
+  #define LOG_WARNING_LIMITED(logger, interval, burst, ...) \
+    LOG_PRINT_LIMITED(logger, LOG_LEVEL_WARNING, interval, burst, __VA_ARGS__)
+  #define LOG_WARNING_EVERY(logger, n, ...) LOG_PRINT_EVERY(logger, LOG_LEVEL_WARNING, n, __VA_ARGS__)
+  #define LOG_WARNING_SAMPLED(logger, probability, ...) \
+    LOG_PRINT_SAMPLED(logger, LOG_LEVEL_WARNING, probability, __VA_ARGS__)
+#else
+  #define LOG_WARNING(logger, ...) LOG_DISCARD(logger, __VA_ARGS__)
+  #define LOG_WARNING_LIMITED(logger, interval, burst, ...) LOG_DISCARD(logger, __VA_ARGS__)
+  #define LOG_WARNING_EVERY(logger, n, ...) LOG_DISCARD(logger, __VA_ARGS__)
+  #define LOG_WARNING_SAMPLED(logger, probability, ...) LOG_DISCARD(logger, __VA_ARGS__)
+#endif
+
+#if LOG_LEVEL_MAX >= LOG_LEVEL_INFO
+  #define LOG_INFO(logger, ...) LOG_PRINT(logger, LOG_LEVEL_INFO, __VA_ARGS__)
+  #define LOG_INFO_LIMITED(logger, interval, burst, ...) \
+    LOG_PRINT_LIMITED(logger, LOG_LEVEL_INFO, interval, burst, __VA_ARGS__)
+  #define LOG_INFO_EVERY(logger, n, ...) LOG_PRINT_EVERY(logger, LOG_LEVEL_INFO, n, __VA_ARGS__)
+  #define LOG_INFO_SAMPLED(logger, probability, ...) \
+    LOG_PRINT_SAMPLED(logger, LOG_LEVEL_INFO, probability, __VA_ARGS__)
+#else
+  #define LOG_INFO(logger, ...) LOG_DISCARD(logger, __VA_ARGS__)
+  #define LOG_INFO_LIMITED(logger, interval, burst, ...) LOG_DISCARD(logger, __VA_ARGS__)
+  #define LOG_INFO_EVERY(logger, n, ...) LOG_DISCARD(logger, __VA_ARGS__)
+  #define LOG_INFO_SAMPLED(logger, probability, ...) LOG_DISCARD(logger, __VA_ARGS__)
+#endif
+
+#if LOG_LEVEL_MAX >= LOG_LEVEL_DEBUG
+  #define LOG_DEBUG(logger, ...) LOG_PRINT(logger, LOG_LEVEL_DEBUG, __VA_ARGS__)
+  #define LOG_DEBUG_LIMITED(logger, interval, burst, ...) \
+    LOG_PRINT_LIMITED(logger, LOG_LEVEL_DEBUG, interval, burst, __VA_ARGS__)
+  #define LOG_DEBUG_EVERY(logger, n, ...) LOG_PRINT_EVERY(logger, LOG_LEVEL_DEBUG, n, __VA_ARGS__)
+  #define LOG_DEBUG_SAMPLED(logger, probability, ...) \
+    LOG_PRINT_SAMPLED(logger, LOG_LEVEL_DEBUG, probability, __VA_ARGS__)
+#else
+  #define LOG_DEBUG(logger, ...) LOG_DISCARD(logger, __VA_ARGS__)
+  #define LOG_DEBUG_LIMITED(logger, interval, burst, ...) LOG_DISCARD(logger, __VA_ARGS__)
+  #define LOG_DEBUG_EVERY(logger, n, ...) LOG_DISCARD(logger, __VA_ARGS__)
+  #define LOG_DEBUG_SAMPLED(logger, probability, ...) LOG_DISCARD(logger, __VA_ARGS__)
+#endif
+
+#if LOG_LEVEL_MAX >= LOG_LEVEL_TRACE
+  #define LOG_TRACE(logger, ...) LOG_PRINT(logger, LOG_LEVEL_TRACE, __VA_ARGS__)
+  #define LOG_TRACE_LIMITED(logger, interval, burst, ...) \
+    LOG_PRINT_LIMITED(logger, LOG_LEVEL_TRACE, interval, burst, __VA_ARGS__)
+  #define LOG_TRACE_EVERY(logger, n, ...) LOG_PRINT_EVERY(logger, LOG_LEVEL_TRACE, n, __VA_ARGS__)
+  #define LOG_TRACE_SAMPLED(logger, probability, ...) \
+    LOG_PRINT_SAMPLED(logger, LOG_LEVEL_TRACE, probability, __VA_ARGS__)
+#else
+  #define LOG_TRACE(logger, ...) LOG_DISCARD(logger, __VA_ARGS__)
+  #define LOG_TRACE_LIMITED(logger, interval, burst, ...) LOG_DISCARD(logger, __VA_ARGS__)
+  #define LOG_TRACE_EVERY(logger, n, ...) LOG_DISCARD(logger, __VA_ARGS__)
+  #define LOG_TRACE_SAMPLED(logger, probability, ...) LOG_DISCARD(logger, __VA_ARGS__)
+#endif
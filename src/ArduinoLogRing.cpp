@@ -0,0 +1,228 @@
+#include "ArduinoLogRing.hpp"
+
+#if LOG_ASYNC_BUFFER_SIZE > 0
+
+static_assert((LOG_ASYNC_BUFFER_SIZE & (LOG_ASYNC_BUFFER_SIZE - 1)) == 0,
+              "LOG_ASYNC_BUFFER_SIZE must be a power of two");
+static_assert(LOG_ASYNC_BUFFER_SIZE <= (LogRingIndex) ~(LogRingIndex) 0 / 2 + 1,
+              "LOG_ASYNC_BUFFER_SIZE is too large for this target");
+
+#define LOG_ENTRY_FREE      0
+#define LOG_ENTRY_COMMITTED 1
+
+namespace {
+
+#if LOG_RING_LOCK_FREE
+
+  inline LogRingIndex load(const volatile LogRingIndex* p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+  }
+
+  inline void store(volatile LogRingIndex* p, LogRingIndex value) {
+    __atomic_store_n(p, value, __ATOMIC_RELEASE);
+  }
+
+  inline bool compareExchange(volatile LogRingIndex* p, LogRingIndex expected, LogRingIndex desired) {
+    return __atomic_compare_exchange_n(p, &expected, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+  }
+
+  inline void increment(volatile uint32_t* p) {
+    __atomic_fetch_add(p, 1, __ATOMIC_RELAXED);
+  }
+
+#else
+
+  // Masks interrupts and restores the previous state, so it is safe to use inside an ISR.
+  class InterruptLock {
+    public:
+      #if defined(__AVR__)
+        InterruptLock() : _state(SREG) { cli(); }
+        ~InterruptLock() { SREG = _state; }
+      private:
+        uint8_t _state;
+      #elif defined(ESP8266)
+        InterruptLock() : _state(xt_rsil(15)) {}
+        ~InterruptLock() { xt_wsr_ps(_state); }
+      private:
+        uint32_t _state;
+      #elif defined(__arm__)
+        InterruptLock() : _state(__get_PRIMASK()) { __disable_irq(); }
+        ~InterruptLock() { __set_PRIMASK(_state); }
+      private:
+        uint32_t _state;
+      #else
+        InterruptLock() { noInterrupts(); }
+        ~InterruptLock() { interrupts(); }
+      #endif
+  };
+
+  inline LogRingIndex load(const volatile LogRingIndex* p) {
+    InterruptLock lock;
+    return *p;
+  }
+
+  inline void store(volatile LogRingIndex* p, LogRingIndex value) {
+    InterruptLock lock;
+    *p = value;
+  }
+
+  inline bool compareExchange(volatile LogRingIndex* p, LogRingIndex expected, LogRingIndex desired) {
+    InterruptLock lock;
+    if (*p != expected)
+      return false;
+    *p = desired;
+    return true;
+  }
+
+  inline void increment(volatile uint32_t* p) {
+    InterruptLock lock;
+    *p = *p + 1;
+  }
+
+#endif
+
+  inline uint8_t loadState(const uint8_t* p) {
+    #if LOG_RING_LOCK_FREE
+      return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+    #else
+      // Single core: a byte access is atomic, only the compiler must not reorder around it
+      uint8_t value = *(const volatile uint8_t*) p;
+      __asm__ __volatile__("" ::: "memory");
+      return value;
+    #endif
+  }
+
+  inline void storeState(uint8_t* p, uint8_t value) {
+    #if LOG_RING_LOCK_FREE
+      __atomic_store_n(p, value, __ATOMIC_RELEASE);
+    #else
+      __asm__ __volatile__("" ::: "memory");
+      *(volatile uint8_t*) p = value;
+    #endif
+  }
+
+}
+
+LogRing::LogRing() : _head(0), _tail(0), _consumer(0), _dropped(0) {
+  memset(_data, 0, sizeof(_data));
+}
+
+bool LogRing::push(uint8_t level, const uint8_t* data, size_t size, uint8_t policy) {
+  if (size > 0xFFFF || size + kHeader > kCapacity) {
+    increment(&_dropped);
+    return false;
+  }
+
+  const LogRingIndex need = (LogRingIndex) (kHeader + size);
+  LogRingIndex head;
+  for (;;) {
+    head = load(&_head);
+    LogRingIndex used = (LogRingIndex) (head - load(&_tail));
+    if (used + need > kCapacity) {
+      if (policy == LOG_OVERFLOW_DROP_OLDEST && discardOldest())
+        continue;
+      if (policy == LOG_OVERFLOW_BLOCK)
+        continue;
+      increment(&_dropped);
+      return false;
+    }
+    if (compareExchange(&_head, head, (LogRingIndex) (head + need)))
+      break;
+  }
+
+  const uint8_t header[3] = { level, (uint8_t) size, (uint8_t) (size >> 8) };
+  copyIn((LogRingIndex) (head + 1), header, sizeof(header));
+  copyIn((LogRingIndex) (head + kHeader), data, size);
+  storeState(&_data[head & kMask], LOG_ENTRY_COMMITTED);
+  return true;
+}
+
+bool LogRing::pop(uint8_t& level, uint8_t* data, size_t& size) {
+  if (!compareExchange(&_consumer, 0, 1))
+    return false;
+
+  bool taken = false;
+  LogRingIndex tail = _tail;
+  if (tail != load(&_head) && loadState(&_data[tail & kMask]) == LOG_ENTRY_COMMITTED) {
+    uint8_t header[3];
+    copyOut((LogRingIndex) (tail + 1), header, sizeof(header));
+    size_t length = header[1] | ((size_t) header[2] << 8);
+
+    level = header[0];
+    if (length < size) {
+      size = length;
+    }
+    copyOut((LogRingIndex) (tail + kHeader), data, size);
+    release(tail, (LogRingIndex) (kHeader + length));
+    taken = true;
+  }
+
+  store(&_consumer, 0);
+  return taken;
+}
+
+uint32_t LogRing::dropped() const {
+  #if LOG_RING_LOCK_FREE
+    return __atomic_load_n(&_dropped, __ATOMIC_RELAXED);
+  #else
+    InterruptLock lock;
+    return _dropped;
+  #endif
+}
+
+// Entries of level 0 are kept: the binary header and format frames are sent only once, and the
+// records after them cannot be decoded without them.
+bool LogRing::discardOldest() {
+  if (!compareExchange(&_consumer, 0, 1))
+    return false;
+
+  bool discarded = false;
+  LogRingIndex tail = _tail;
+  if (tail != load(&_head) && loadState(&_data[tail & kMask]) == LOG_ENTRY_COMMITTED) {
+    uint8_t header[3];
+    copyOut((LogRingIndex) (tail + 1), header, sizeof(header));
+    if (header[0] != 0) {
+      release(tail, (LogRingIndex) (kHeader + (header[1] | (header[2] << 8))));
+      increment(&_dropped);
+      discarded = true;
+    }
+  }
+
+  store(&_consumer, 0);
+  return discarded;
+}
+
+void LogRing::copyIn(LogRingIndex at, const uint8_t* data, size_t size) {
+  size_t offset = at & kMask;
+  size_t first = kCapacity - offset;
+  if (first > size) {
+    first = size;
+  }
+  memcpy(_data + offset, data, first);
+  memcpy(_data, data + first, size - first);
+}
+
+void LogRing::copyOut(LogRingIndex at, uint8_t* data, size_t size) const {
+  size_t offset = at & kMask;
+  size_t first = kCapacity - offset;
+  if (first > size) {
+    first = size;
+  }
+  memcpy(data, _data + offset, first);
+  memcpy(data + first, _data, size - first);
+}
+
+// Clears a consumed entry, so no stale byte can be taken for the state of a later entry, and
+// hands its space back to the producers.
+void LogRing::release(LogRingIndex tail, LogRingIndex size) {
+  size_t offset = tail & kMask;
+  size_t first = kCapacity - offset;
+  if (first > size) {
+    first = size;
+  }
+  memset(_data + offset, LOG_ENTRY_FREE, first);
+  memset(_data, LOG_ENTRY_FREE, size - first);
+  store(&_tail, (LogRingIndex) (tail + size));
+}
+
+#endif
@@ -0,0 +1,76 @@
+#pragma once
+#include "Arduino.h"
+
+#include <inttypes.h>
+
+// Size in bytes of the buffer used by asynchronous logging, a power of two. 0 compiles
+// asynchronous logging out.
+#ifndef LOG_ASYNC_BUFFER_SIZE
+  #define LOG_ASYNC_BUFFER_SIZE 0
+#endif
+
+// What a log call does when the asynchronous buffer is full
+#define LOG_OVERFLOW_DROP_NEWEST 0  // discard the new message
+#define LOG_OVERFLOW_DROP_OLDEST 1  // discard buffered messages until the new one fits, or the new
+                                    // one if the oldest is a binary header or format frame
+#define LOG_OVERFLOW_BLOCK       2  // wait until the drain made room, never use from an ISR; needs a
+                                    // drain in another task, as a log call waiting in the task
+                                    // that drains never returns
+
+// Targets with a native compare-and-swap use it, the others a short interrupt lock around the
+// index updates. Copying a message in or out of the buffer is never done under a lock.
+#if defined(__GCC_HAVE_SYNC_COMPARE_AND_SWAP_4)
+  #define LOG_RING_LOCK_FREE 1
+  typedef uint32_t LogRingIndex;
+#else
+  #define LOG_RING_LOCK_FREE 0
+  typedef uint16_t LogRingIndex;
+#endif
+
+#if LOG_ASYNC_BUFFER_SIZE > 0
+
+/**
+ * Multi-producer, single-consumer ring of finished log messages, safe to push to from ISRs and
+ * concurrent tasks.
+ *
+ * Each entry is a 4 byte header (state, level, 16 bit size) followed by the message bytes, which
+ * may wrap around the end of the buffer. A producer reserves its entry by advancing the head with
+ * a compare-and-swap, copies the message and then publishes the entry by setting its state. The
+ * consumer takes committed entries in order, stopping at one that is still being written, and
+ * clears each consumed entry before handing the space back, so a stale byte can never look like a
+ * committed state.
+ *
+ * The tail is owned by whoever holds the consumer flag: the drain, or a producer discarding the
+ * oldest entry under LOG_OVERFLOW_DROP_OLDEST.
+ */
+class LogRing {
+  public:
+    LogRing();
+
+    // False if the message was dropped
+    bool push(uint8_t level, const uint8_t* data, size_t size, uint8_t policy);
+
+    // Takes the oldest committed entry. size holds the capacity of data on entry and the size of
+    // the message on return; longer messages are cut. False if there is nothing to take now.
+    bool pop(uint8_t& level, uint8_t* data, size_t& size);
+
+    uint32_t dropped() const;
+
+  private:
+    static const LogRingIndex kCapacity = LOG_ASYNC_BUFFER_SIZE;
+    static const LogRingIndex kMask = LOG_ASYNC_BUFFER_SIZE - 1;
+    static const LogRingIndex kHeader = 4;
+
+    bool discardOldest();
+    void copyIn(LogRingIndex at, const uint8_t* data, size_t size);
+    void copyOut(LogRingIndex at, uint8_t* data, size_t size) const;
+    void release(LogRingIndex tail, LogRingIndex size);
+
+    uint8_t _data[LOG_ASYNC_BUFFER_SIZE];
+    volatile LogRingIndex _head;
+    volatile LogRingIndex _tail;
+    volatile LogRingIndex _consumer;
+    volatile uint32_t _dropped;
+};
+
+#endif
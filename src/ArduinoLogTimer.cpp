@@ -0,0 +1,63 @@
+#include "ArduinoLogTimer.hpp"
+
+#ifndef DISABLE_LOGGING
+
+Logging::Clock LogTimer::_clock = nullptr;
+
+namespace {
+
+  struct TimerFormat {
+    static constexpr const char* str() { return "%s: %u us"; }
+  };
+
+  struct ProbeFormat {
+    static constexpr const char* str() { return "%s: n=%u min=%u max=%u mean=%u us"; }
+  };
+
+}
+
+#endif
+
+void LogTimer::setClock(Logging::Clock clock) {
+  #ifndef DISABLE_LOGGING
+    _clock = clock;
+  #endif
+}
+
+// The probe is updated under the record lock, the report is logged after releasing it
+void LogTimer::stop(unsigned long elapsed) {
+  #ifndef DISABLE_LOGGING
+    if (_probe == nullptr) {
+      if (elapsed >= _threshold) {
+        _log.printCompiled<TimerFormat>(_level, _name, elapsed);
+      }
+      return;
+    }
+
+    unsigned long count, min, max;
+    uint64_t total;
+    {
+      Logging::RecordLock lock;
+      LogProbe& probe = *_probe;
+      if (probe._count == 0) {
+        probe._start = _start;
+        probe._min = elapsed;
+        probe._max = elapsed;
+        probe._total = 0;
+      }
+      ++probe._count;
+      if (elapsed < probe._min) probe._min = elapsed;
+      if (elapsed > probe._max) probe._max = elapsed;
+      probe._total += elapsed;
+      if (_start + elapsed - probe._start < probe._interval * 1000UL)
+        return;
+
+      count = probe._count;
+      min = probe._min;
+      max = probe._max;
+      total = probe._total;
+      probe._count = 0;
+    }
+    _log.printCompiled<ProbeFormat>(_level, _name, count, min, max, (unsigned long) (total / count));
+  #endif
+}
@@ -0,0 +1,107 @@
+#pragma once
+#include "ArduinoLog.hpp"
+
+/**
+ * Timing probes for hot paths. A LogTimer reads a microsecond clock when it is created and logs
+ * the time until it goes out of scope, e.g.
+ *
+ *   void readSensor() {
+ *     LogTimer timer(Log, LOG_LEVEL_DEBUG, "readSensor");   // "readSensor: 1840 us"
+ *     ...
+ *   }
+ *
+ * With a threshold only scopes that take at least that many microseconds are logged. At a
+ * disabled level, or a constant level above LOG_LEVEL_MAX, a timer costs one compare and does not
+ * read the clock.
+ *
+ * Given a LogProbe instead of a name, timers only add their time to the probe. The first timer
+ * that ends report interval milliseconds after the probe's first time logs the count, minimum,
+ * maximum and mean of the period and starts a new one:
+ *
+ *   static LogProbe probe("isr", 10000);
+ *   LogTimer timer(Log, LOG_LEVEL_DEBUG, probe);   // "isr: n=52113 min=3 max=41 mean=4 us"
+ *
+ * The interval is measured with the microsecond clock, so it should stay below an hour where
+ * micros() wraps after 71 minutes. LOG_SCOPE_TIMER() and LOG_SCOPE_PROBE() declare both.
+ */
+class LogProbe {
+  public:
+    constexpr LogProbe(const char* name, unsigned long interval)
+      : _name(name), _interval(interval), _start(0), _count(0), _min(0), _max(0), _total(0) {}
+
+  private:
+    friend class LogTimer;
+
+    const char* _name;
+    unsigned long _interval;  // milliseconds between reports
+    unsigned long _start;     // clock at the first time of the period
+    unsigned long _count;
+    unsigned long _min;
+    unsigned long _max;
+    uint64_t _total;
+};
+
+class LogTimer {
+  public:
+    LogTimer(Logging& log, int level, const char* name, unsigned long threshold = 0)
+      : _log(log), _name(name), _probe(nullptr), _threshold(threshold), _level(level), _start(0),
+        _enabled(enabled(log, level)) {
+      if (_enabled) _start = now();
+    }
+
+    LogTimer(Logging& log, int level, LogProbe& probe)
+      : _log(log), _name(probe._name), _probe(&probe), _threshold(0), _level(level), _start(0),
+        _enabled(enabled(log, level)) {
+      if (_enabled) _start = now();
+    }
+
+    ~LogTimer() {
+      if (_enabled) stop(now() - _start);
+    }
+
+    LogTimer(const LogTimer&) = delete;
+    LogTimer& operator=(const LogTimer&) = delete;
+
+    // Source of the readings in microseconds. Defaults to micros(); nullptr restores it.
+    static void setClock(Logging::Clock clock);
+
+    static unsigned long now() {
+      #ifndef DISABLE_LOGGING
+        return _clock != nullptr ? _clock() : micros();
+      #else
+        return 0;
+      #endif
+    }
+
+  private:
+    static bool enabled(Logging& log, int level) {
+      return level <= LOG_LEVEL_MAX && log.shouldLog(level);
+    }
+
+    void stop(unsigned long elapsed);
+
+    Logging& _log;
+    const char* _name;
+    LogProbe* _probe;
+    unsigned long _threshold;
+    int _level;
+    unsigned long _start;
+    bool _enabled;
+
+    #ifndef DISABLE_LOGGING
+      static Logging::Clock _clock;
+    #endif
+};
+
+#define LOG_TIMER_CONCAT_(a, b) a##b
+#define LOG_TIMER_NAME_(prefix, line) LOG_TIMER_CONCAT_(prefix, line)
+
+// Times the rest of the enclosing scope: LOG_SCOPE_TIMER(Log, LOG_LEVEL_DEBUG, "parse"[, threshold])
+#define LOG_SCOPE_TIMER(logger, level, ...) \
+  LogTimer LOG_TIMER_NAME_(logTimer_, __LINE__)(logger, level, __VA_ARGS__)
+
+// Adds the rest of the enclosing scope to a probe of the call site that reports every interval
+// milliseconds. interval must be a constant.
+#define LOG_SCOPE_PROBE(logger, level, name, interval)                            \
+  static LogProbe LOG_TIMER_NAME_(logProbe_, __LINE__)(name, interval);           \
+  LogTimer LOG_TIMER_NAME_(logTimer_, __LINE__)(logger, level, LOG_TIMER_NAME_(logProbe_, __LINE__))
@@ -1,18 +1,24 @@
 #include "ArduinoLog.hpp"
 #include <Arduino.h>
+#include <atomic>
 #include <bitset>
 #include <iomanip>
 #include <iostream>
+#include <math.h>
 #include <sstream>
 #include <stdio.h>
+#include <string.h>
+#include <thread>
 #include <unity.h>
 
 using namespace fakeit;
 std::stringstream output_;
+int write_calls_ = 0;
 ::Logging Log;
 void reset_output() {
   output_.str(std::string());
   output_.clear();
+  write_calls_ = 0;
 }
 
 std::string decimal_to_binary(int n) {
@@ -33,6 +39,19 @@ void TEST_ASSERT_EQUAL_STRING_STREAM(std::stringstream const &expected_output,
 }
 
 void set_up_logging_captures() {
+  // Complete lines arrive through a single write(); LOG_EOL is "\r\n" while the
+  // expectations below use "\n", so carriage returns are dropped.
+  When(OverloadedMethod(ArduinoFake(Serial), write,
+                        size_t(const uint8_t *, size_t)))
+      .AlwaysDo([&](const uint8_t *buffer, size_t size) -> int {
+        ++write_calls_;
+        for (size_t i = 0; i < size; ++i) {
+          if (buffer[i] != '\r') {
+            output_ << (char)buffer[i];
+          }
+        }
+        return size;
+      });
   When(OverloadedMethod(ArduinoFake(Serial), println, size_t(void)))
       .AlwaysDo([&]() -> int {
         output_ << "\n";
@@ -119,9 +138,16 @@ void set_up_logging_captures() {
   When(Method(ArduinoFake(Serial), flush)).AlwaysReturn();
 }
 
+// Advances by 5 microseconds per reading, the time of a message with LOG_STATISTICS
+std::atomic<unsigned long> test_micros_(0);
+unsigned long test_micros() { return test_micros_ += 5; }
+
 void setUp(void) {
   ArduinoFakeReset();
   set_up_logging_captures();
+#if LOG_STATISTICS
+  Logging::setStatisticsClock(test_micros);
+#endif
   Logging::setLevel(LOG_LEVEL_TRACE);
   Logging::setOutput(&Serial);
   Logging::setDigit(2);
@@ -147,7 +173,24 @@ void test_int_hex_values() {
              int_value2);
   std::stringstream expected_output;
   expected_output << "Log as Info with hex values     : 98, 0x0098\n"
-                  << "Log as Info with hex values     : fdf2, 0xfdf2\n";
+                  << "Log as Info with hex values     : FDF2, 0xFDF2\n";
+  TEST_ASSERT_EQUAL_STRING_STREAM(expected_output, output_);
+}
+
+void test_integer_widths() {
+  reset_output();
+  Log.info("Log as Info with padded hex     : %X, %X, %X", 0xF, 0xFFF,
+           0x12345);
+  LOG_INFO(Log, "Log as Info with wide values    : %d, %u, %d",
+           -9223372036854775807LL - 1, 18446744073709551615ULL, -42);
+  LOG_INFO(Log, "Log as Info with negative hex   : %x, %X, %B",
+           (short)-2, (signed char)-1, (signed char)-128);
+  std::stringstream expected_output;
+  expected_output
+      << "Log as Info with padded hex     : 0x000F, 0x0FFF, 0x12345\n"
+         "Log as Info with wide values    : -9223372036854775808, "
+         "18446744073709551615, -42\n"
+         "Log as Info with negative hex   : FFFE, 0x00FF, 0b10000000\n";
   TEST_ASSERT_EQUAL_STRING_STREAM(expected_output, output_);
 }
 
@@ -210,6 +253,16 @@ void test_flash_string_values() {
   TEST_ASSERT_EQUAL_STRING_STREAM(expected_output, output_);
 }
 
+void test_flash_format() {
+  reset_output();
+  Log.info(F("Flash format with literal runs longer than a chunk: %d, %S and %% end"),
+           42, F("a flash string argument"));
+  std::stringstream expected_output;
+  expected_output
+      << "Flash format with literal runs longer than a chunk: 42, a flash string argument and % end\n";
+  TEST_ASSERT_EQUAL_STRING_STREAM(expected_output, output_);
+}
+
 void test_string_values() {
   reset_output();
   String stringValue1 = "this is a string";
@@ -230,17 +283,32 @@ void test_float_values() {
   TEST_ASSERT_EQUAL_STRING_STREAM(expected_output, output_);
 }
 
-// void test_double_values() {
-//   reset_output();
-//   double double_value = 1234.56789;
-//   // Log.info(F("%D"), double_value);
-//   Log.info(F("Log as Info with double value   : %D"), double_value);
-//   Log.info("Log as Info with double value   : %D", double_value);
-//   std::stringstream expected_output;
-//   expected_output << "Log as Info with double value   : 1234.57\n"
-//                   << "Log as Info with double value   : 1234.57\n";
-//   TEST_ASSERT_EQUAL_STRING_STREAM(expected_output, output_);
-// }
+void test_double_values() {
+  reset_output();
+  double double_value = 1234.56789;
+  // Log.info(F("%D"), double_value);
+  Log.info(F("Log as Info with double value   : %D"), double_value);
+  Log.info("Log as Info with double value   : %D", double_value);
+  std::stringstream expected_output;
+  expected_output << "Log as Info with double value   : 1234.57\n"
+                  << "Log as Info with double value   : 1234.57\n";
+  TEST_ASSERT_EQUAL_STRING_STREAM(expected_output, output_);
+}
+
+void test_float_precision() {
+  reset_output();
+  Log.info("Log as Info with precision      : %.3f, %.0F, %f", 1.23456, 2.5,
+           0.995);
+  LOG_INFO(Log, "Log as Info with precision      : %.3f, %.0F, %f", 1.23456,
+           2.5, 0.995);
+  Log.info("Log as Info with special values : %f, %f, %f", NAN, -INFINITY,
+           5e12);
+  std::stringstream expected_output;
+  expected_output << "Log as Info with precision      : 1.235, 3, 1.00\n"
+                  << "Log as Info with precision      : 1.235, 3, 1.00\n"
+                  << "Log as Info with special values : nan, -inf, ovf\n";
+  TEST_ASSERT_EQUAL_STRING_STREAM(expected_output, output_);
+}
 
 void test_mixed_values() {
   reset_output();
@@ -326,23 +394,937 @@ void test_combined_internal_variables() {
   TEST_ASSERT_EQUAL_STRING_STREAM(expected_output, output_);
 }
 
+unsigned long fixed_clock() { return 3723004UL; }
+
+void test_custom_clock() {
+  reset_output();
+  Logging::setClock(fixed_clock);
+  Logging::setPrefix("%M ");
+  Log.info("Time=%m");
+  LOG_INFO(Log, "Time=%m");
+  Logging::clearPrefix();
+  Logging::setClock(nullptr);
+  std::stringstream expected_output;
+  expected_output << "01:02:03.004 Time=3723004\n"
+                     "01:02:03.004 Time=3723004\n";
+  TEST_ASSERT_EQUAL_STRING_STREAM(expected_output, output_);
+}
+
+void test_prefix_format() {
+  reset_output();
+  Logging moduleLog("Module");
+  Logging::setPrefix("[%n|%v|%L] 100%% ");
+  moduleLog.info("Prefixed line");
+  Logging::setPrefix("%L: ");
+  moduleLog.warning("Prefix changed");
+  Logging::setPrefix("[%-6L|%8n] ");
+  moduleLog.info("Padded prefix");
+  // More tokens than LOG_PREFIX_TOKENS: parsed for every line
+  Logging::setPrefix("%.1L %.1L %.1L %.1L %.1L %-6L|%8n] ");
+  moduleLog.error("Long prefix");
+  Logging::clearPrefix();
+  moduleLog.error("No prefix");
+  std::stringstream expected_output;
+  expected_output << "[Module|TRCE|INFO] 100% Prefixed line\n"
+                     "WARN: Prefix changed\n"
+                     "[INFO  |  Module] Padded prefix\n"
+                     "E E E E E ERRO  |  Module] Long prefix\n"
+                     "No prefix\n";
+  TEST_ASSERT_EQUAL_STRING_STREAM(expected_output, output_);
+}
+
+class StringOutput : public Print {
+public:
+  std::string lines;
+  size_t write(uint8_t c) override {
+    lines += (char)c;
+    return 1;
+  }
+  size_t write(const uint8_t *buffer, size_t size) override {
+    lines.append((const char *)buffer, size);
+    return size;
+  }
+};
+
+// An override of the deprecated printInternal(char), as written for earlier versions
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+class LegacyLogging : public Logging {
+public:
+  using Logging::printInternal;
+  void printInternal(char format) override {
+    if (format == 'X') {
+      _logOutput->print("legacy");
+    } else {
+      Logging::printInternal(format);
+    }
+  }
+};
+#pragma GCC diagnostic pop
+
+void test_legacy_print_internal() {
+  reset_output();
+  LegacyLogging legacy;
+  Logging::setPrefix("[%X|%L] ");
+  legacy.info("Custom variable");
+  Logging::clearPrefix();
+  std::stringstream expected_output;
+  expected_output << "[legacy|INFO] Custom variable\n";
+  TEST_ASSERT_EQUAL_STRING_STREAM(expected_output, output_);
+  TEST_ASSERT_EQUAL_INT(1, write_calls_);
+}
+
+// A custom specifier added through the deprecated printFormat(char, va_list *)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+class LegacyFormatLogging : public Logging {
+public:
+  using Logging::printFormat;
+  void printFormat(const char format, va_list *args) override {
+    if (format == 'Z') {
+      _logOutput->print(va_arg(*args, int) == 7 ? "seven" : "other");
+    } else {
+      Logging::printFormat(format, args);
+    }
+  }
+};
+#pragma GCC diagnostic pop
+
+void test_legacy_print_format() {
+  reset_output();
+  LegacyFormatLogging legacy;
+  legacy.info("Custom %Z, %d, %Z", 7, 5, 8);
+  std::stringstream expected_output;
+  expected_output << "Custom seven, 5, other\n";
+  TEST_ASSERT_EQUAL_STRING_STREAM(expected_output, output_);
+  TEST_ASSERT_EQUAL_INT(1, write_calls_);
+
+  // Assigning _logOutput replaces the outputs
+  StringOutput lines;
+  Logging::_logOutput = &lines;
+  Log.info("Assigned output");
+  TEST_ASSERT_TRUE(Logging::_logOutput == &lines);
+  TEST_ASSERT_EQUAL_STRING("Assigned output\r\n", lines.lines.c_str());
+}
+
+void test_single_write_per_line() {
+  reset_output();
+  Logging::setPrefix("[%L] ");
+  Log.info("Log as Info with mixed values  : %d, %s, %T", 42, "text", true);
+  Logging::clearPrefix();
+  std::stringstream expected_output;
+  expected_output << "[INFO] Log as Info with mixed values  : 42, text, true\n";
+  TEST_ASSERT_EQUAL_STRING_STREAM(expected_output, output_);
+  TEST_ASSERT_EQUAL_INT(1, write_calls_);
+}
+
+void test_truncated_line() {
+  reset_output();
+  std::string long_value(LOG_LINE_BUFFER_SIZE * 2, 'a');
+  Log.info("%s", long_value.c_str());
+  // The line keeps LOG_LINE_BUFFER_SIZE bytes, "\r\n" included.
+  std::string expected =
+      std::string(LOG_LINE_BUFFER_SIZE - 5, 'a') + "...\n";
+  TEST_ASSERT_EQUAL_STRING(expected.c_str(), output_.str().c_str());
+  TEST_ASSERT_EQUAL_INT(1, write_calls_);
+}
+
+void test_compiled_format() {
+  reset_output();
+  const char flashCharArray[] PROGMEM = "flash";
+  LOG_INFO(Log, "Compiled format with values    : %d, %u, %X, %s, %S, %T",
+           -42, 7u, 152, "text", flashCharArray, false);
+  LOG_WARNING(Log, "[%L] Compiled format without arguments, 100%%");
+  std::stringstream expected_output;
+  expected_output
+      << "Compiled format with values    : -42, 7, 0x0098, text, flash, false\n"
+         "[WARN] Compiled format without arguments, 100%\n";
+  TEST_ASSERT_EQUAL_STRING_STREAM(expected_output, output_);
+}
+
+enum TestState { STATE_IDLE, STATE_RUNNING = 5, STATE_FAILED = -3 };
+
+void test_compiled_enum() {
+  // Enumerations are taken as their integer, as by the vararg methods
+  reset_output();
+  TestState state = STATE_RUNNING;
+  const uint8_t bytes[] = {0xAB, 0xCD};
+  LOG_INFO(Log, "State %d, %X, %d, %h", state, STATE_RUNNING, STATE_FAILED,
+           bytes, STATE_IDLE);
+  Log.info("State %d", state);
+  std::stringstream expected_output;
+  expected_output << "State 5, 0x0005, -3, \n"
+                     "State 5\n";
+  TEST_ASSERT_EQUAL_STRING_STREAM(expected_output, output_);
+}
+
+int evaluations_ = 0;
+int counted_value() {
+  ++evaluations_;
+  return evaluations_;
+}
+
+void test_lazy_arguments() {
+  reset_output();
+  evaluations_ = 0;
+  Logging::setLevel(LOG_LEVEL_INFO);
+  TEST_ASSERT_TRUE(Log.isEnabled(LOG_LEVEL_INFO));
+  TEST_ASSERT_FALSE(Log.isEnabled(LOG_LEVEL_DEBUG));
+  LOG_DEBUG(Log, "Disabled level with value      : %d", counted_value());
+  TEST_ASSERT_EQUAL_INT(0, evaluations_);
+  LOG_INFO(Log, "Enabled level with value       : %d", counted_value());
+  TEST_ASSERT_EQUAL_INT(1, evaluations_);
+  std::stringstream expected_output;
+  expected_output << "Enabled level with value       : 1\n";
+  TEST_ASSERT_EQUAL_STRING_STREAM(expected_output, output_);
+}
+
+void test_binary_mode() {
+  reset_output();
+  When(Method(ArduinoFake(), millis)).AlwaysReturn(5432);
+  Logging::setBinaryMode(true);
+  Log.info("Value: %d", 5);
+  Log.info("Value: %d", 6);
+  Logging::setBinaryMode(false);
+  // Native target: 4 byte int, 8 byte long and double, little endian
+  const unsigned char expected[] = {
+      0xA5, 'H', 5,  1, 4, 8, 8, 1,
+      0xA5, 'F', 12, 0, 0, 'V', 'a', 'l', 'u', 'e', ':', ' ', '%', 'd', 0,
+      0xA5, 'R', 10, 0, LOG_LEVEL_INFO, 0x38, 0x15, 0, 0, 5, 0, 0, 0,
+      0xA5, 'R', 10, 0, LOG_LEVEL_INFO, 0x38, 0x15, 0, 0, 6, 0, 0, 0};
+  std::string actual = output_.str();
+  TEST_ASSERT_EQUAL_INT(sizeof(expected), actual.size());
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, actual.data(), sizeof(expected));
+}
+
+void test_binary_long_format() {
+  // A format longer than the record is cut and flagged, so the decoder marks its messages
+  static char format[300];
+  memset(format, 'x', sizeof(format) - 3);
+  strcpy(format + sizeof(format) - 3, "%d");
+  reset_output();
+  Logging::setBinaryMode(true);
+  Log.info(format, 5);
+  Logging::setBinaryMode(false);
+  std::string actual = output_.str();
+  size_t frame = actual.find("\xA5" "F");
+  TEST_ASSERT_TRUE(frame != std::string::npos);
+  TEST_ASSERT_EQUAL_UINT8(LogRecord::kMaxPayload, (uint8_t)actual[frame + 2]);
+  TEST_ASSERT_EQUAL_UINT8(LOG_FORMAT_TRUNCATED, (uint8_t)actual[frame + 4] & LOG_FORMAT_TRUNCATED);
+  TEST_ASSERT_EQUAL_UINT8('x', actual[frame + 2 + LogRecord::kMaxPayload]);
+}
+
+void test_async_output() {
+  reset_output();
+  Logging::setAsync(true);
+  Log.info("Queued line %d", 1);
+  Log.warning("Queued line %d", 2);
+  TEST_ASSERT_EQUAL_INT(0, write_calls_);
+  Logging::drain();
+  Logging::setAsync(false);
+  std::stringstream expected_output;
+  expected_output << "Queued line 1\n"
+                     "Queued line 2\n";
+  TEST_ASSERT_EQUAL_STRING_STREAM(expected_output, output_);
+  TEST_ASSERT_EQUAL_INT(2, write_calls_);
+}
+
+void test_async_overflow() {
+  reset_output();
+  const int lines = LOG_ASYNC_BUFFER_SIZE / 8;
+  uint32_t dropped = Logging::getDroppedCount();
+  Logging::setAsync(true);
+  Logging::setOverflowPolicy(LOG_OVERFLOW_DROP_NEWEST);
+  for (int i = 0; i < lines; ++i) {
+    Log.info("Line %d", i);
+  }
+  Logging::drain();
+  Logging::setAsync(false);
+  dropped = Logging::getDroppedCount() - dropped;
+  TEST_ASSERT_TRUE(dropped > 0);
+  TEST_ASSERT_EQUAL_INT(lines, write_calls_ + (int)dropped);
+  // The oldest lines were kept
+  TEST_ASSERT_EQUAL_INT(0, output_.str().find("Line 0\nLine 1\n"));
+}
+
+// True if the frames after the text lines start with a header and every record
+// follows the format frame of its id
+bool binary_stream_decodes(const std::string &stream, int &records) {
+  bool header = false;
+  bool formats[256] = {false};
+  records = 0;
+  size_t i = stream.find((char)LOG_FRAME_SYNC);
+  for (; i != std::string::npos && i + 3 <= stream.size(); i += 3 + (uint8_t)stream[i + 2]) {
+    if ((uint8_t)stream[i] != LOG_FRAME_SYNC)
+      return false;
+    char type = stream[i + 1];
+    if (type == LOG_FRAME_HEADER) {
+      header = true;
+      memset(formats, 0, sizeof(formats));
+    } else if (type == LOG_FRAME_FORMAT) {
+      formats[(uint8_t)stream[i + 3]] = true;
+    } else if (type == LOG_FRAME_RECORD) {
+      if (!header || !formats[(uint8_t)stream[i + 3]])
+        return false;
+      ++records;
+    }
+  }
+  return header;
+}
+
+void async_binary_overflow(uint8_t policy) {
+  const int lines = LOG_ASYNC_BUFFER_SIZE / 8;
+  StringOutput stream;
+  Logging::setOutput(&stream);
+  Logging::setAsync(true);
+  Logging::setOverflowPolicy(policy);
+  // A full buffer when the stream starts drops its header and first format
+  for (int i = 0; i < lines; ++i) {
+    Log.info("Line %d", i);
+  }
+  Logging::setBinaryMode(true);
+  Log.info("Value: %d", 1);
+  Logging::drain();
+  // A burst evicts the oldest records, never the frames they refer to
+  for (int i = 0; i < lines; ++i) {
+    Log.info("Value: %d", i);
+  }
+  Logging::drain();
+  Log.info("Value: %d", 2);
+  Logging::drain();
+  Logging::setBinaryMode(false);
+  Logging::setAsync(false);
+  Logging::setOverflowPolicy(LOG_OVERFLOW_DROP_NEWEST);
+  int records = 0;
+  TEST_ASSERT_TRUE(binary_stream_decodes(stream.lines, records));
+  TEST_ASSERT_TRUE(records > 1);
+}
+
+void test_async_binary_overflow() {
+  async_binary_overflow(LOG_OVERFLOW_DROP_NEWEST);
+  async_binary_overflow(LOG_OVERFLOW_DROP_OLDEST);
+}
+
+void test_module_levels() {
+  reset_output();
+  Logging::setLevel(LOG_LEVEL_WARNING);
+  ::Logging NetLog("Net");
+  ::Logging OtherLog("Other");
+  TEST_ASSERT_TRUE(Logging::setModuleLevel("Net", LOG_LEVEL_TRACE));
+  NetLog.trace("Net at %v");
+  OtherLog.info("Below the global level");
+  {
+    ::Logging LaterLog("Net");
+    LaterLog.debug("Created after setModuleLevel");
+  }
+  Logging::setModuleLevel("Net", LOG_LEVEL_INHERIT);
+  NetLog.info("Below the global level again");
+  std::stringstream expected_output;
+  expected_output << "Net at TRCE\n"
+                     "Created after setModuleLevel\n";
+  TEST_ASSERT_EQUAL_STRING_STREAM(expected_output, output_);
+}
+
+void test_multiple_outputs() {
+  reset_output();
+  StringOutput errors;
+  TEST_ASSERT_TRUE(Logging::addOutput(&errors, LOG_LEVEL_ERROR));
+  Logging::setPrefix("[%L] ");
+  Log.error("Written to both outputs");
+  Log.trace("Written to Serial only");
+  Logging::addOutput(&Serial, LOG_LEVEL_SILENT);
+  evaluations_ = 0;
+  LOG_WARNING(Log, "Written to no output %d", counted_value());
+  TEST_ASSERT_EQUAL_INT(0, evaluations_);
+  Logging::clearPrefix();
+  Logging::removeOutput(&errors);
+  std::stringstream expected_output;
+  expected_output << "[ERRO] Written to both outputs\n"
+                     "[TRCE] Written to Serial only\n";
+  TEST_ASSERT_EQUAL_STRING_STREAM(expected_output, output_);
+  TEST_ASSERT_EQUAL_STRING("[ERRO] Written to both outputs\r\n",
+                           errors.lines.c_str());
+}
+
+unsigned long test_time_ = 0;
+unsigned long test_clock() { return test_time_; }
+
+void limited_warning(int i) {
+  LOG_WARNING_LIMITED(Log, 1000, 2, "Sensor %d not responding", i);
+}
+
+void test_rate_limit() {
+  reset_output();
+  Logging::setClock(test_clock);
+  uint32_t suppressed = Logging::getSuppressedCount();
+  test_time_ = 5000;
+  for (int i = 0; i < 5; ++i) {
+    limited_warning(i);
+  }
+  test_time_ = 6000;
+  limited_warning(5);
+  limited_warning(6);
+  Logging::setClock(nullptr);
+  std::stringstream expected_output;
+  expected_output << "Sensor 0 not responding\n"
+                     "Sensor 1 not responding\n"
+                     "Sensor 5 not responding (3 suppressed)\n";
+  TEST_ASSERT_EQUAL_STRING_STREAM(expected_output, output_);
+  TEST_ASSERT_EQUAL_INT(4, Logging::getSuppressedCount() - suppressed);
+}
+
+void test_sampling() {
+  reset_output();
+  for (int i = 0; i < 7; ++i) {
+    LOG_DEBUG_EVERY(Log, 3, "Every third %d", i);
+  }
+  evaluations_ = 0;
+  for (int i = 0; i < 100; ++i) {
+    LOG_TRACE_SAMPLED(Log, 0.0, "Never %d", counted_value());
+  }
+  TEST_ASSERT_EQUAL_INT(0, evaluations_);
+  LOG_TRACE_SAMPLED(Log, 1.0, "Always");
+  std::stringstream expected_output;
+  expected_output << "Every third 0\n"
+                     "Every third 3\n"
+                     "Every third 6\n"
+                     "Always\n";
+  TEST_ASSERT_EQUAL_STRING_STREAM(expected_output, output_);
+}
+
+void test_flight_recorder() {
+  reset_output();
+  // Stands in for memory that is not cleared by a reset
+  static uint8_t retained[256];
+  memset(retained, 0x5A, sizeof(retained));
+  Logging::setClock(fixed_clock);
+  Logging::addOutput(&Serial, LOG_LEVEL_WARNING);
+  TEST_ASSERT_FALSE(Logging::setFlightRecorder(retained, sizeof(retained)));
+  Log.trace("Recorded only %d", 1);
+  Log.warning(F("Recorded and written %s"), "too");
+  LOG_DEBUG(Log, "Recorded from a macro %X", 0xBEEF);
+
+  // After a reset the records are found again and written through the formatter
+  TEST_ASSERT_TRUE(Logging::setFlightRecorder(retained, sizeof(retained)));
+  StringOutput dump;
+  Logging::setPrefix("%M %L ");
+  TEST_ASSERT_EQUAL_INT(3, Log.dumpFlightRecorder(dump));
+  Logging::clearFlightRecorder();
+  TEST_ASSERT_EQUAL_INT(0, Log.dumpFlightRecorder(dump));
+  Logging::setFlightRecorder(nullptr, 0);
+  Logging::clearPrefix();
+  Logging::setClock(nullptr);
+
+  TEST_ASSERT_EQUAL_STRING("Recorded and written too\n", output_.str().c_str());
+  TEST_ASSERT_EQUAL_STRING("01:02:03.004 TRCE Recorded only 1\r\n"
+                           "01:02:03.004 WARN Recorded and written too\r\n"
+                           "01:02:03.004 DBUG Recorded from a macro 0xBEEF\r\n",
+                           dump.lines.c_str());
+}
+
+void test_flight_recorder_moved_format() {
+  // A record whose format text changed, as after a rebuild with the same stamp, is not rendered
+  static uint8_t retained[128];
+  static char format[] = "Moved %d";
+  Logging::setFlightRecorder(retained, sizeof(retained));
+  Logging::clearFlightRecorder();
+  Log.info(format, 1);
+  format[0] = 'm';
+  StringOutput dump;
+  TEST_ASSERT_EQUAL_INT(1, Log.dumpFlightRecorder(dump));
+  Logging::setFlightRecorder(nullptr, 0);
+  TEST_ASSERT_EQUAL_STRING("<unknown format>\r\n", dump.lines.c_str());
+}
+
+void test_flight_recorder_other_build() {
+  // Records of another build are dropped before any of their format addresses
+  // is read
+  alignas(4) static uint8_t retained[128];
+  Logging::setFlightRecorder(retained, sizeof(retained));
+  Logging::clearFlightRecorder();
+  Log.info("Other build %d", 1);
+  Logging::setFlightRecorder(nullptr, 0);
+  retained[4] ^= 0xFF;  // the build stamp follows the magic
+  TEST_ASSERT_FALSE(Logging::setFlightRecorder(retained, sizeof(retained)));
+  StringOutput dump;
+  TEST_ASSERT_EQUAL_INT(0, Log.dumpFlightRecorder(dump));
+  Logging::setFlightRecorder(nullptr, 0);
+  TEST_ASSERT_EQUAL_STRING("", dump.lines.c_str());
+}
+
+void test_statistics() {
+  reset_output();
+  Logging::resetStatistics();
+  Logging::setLevel(LOG_LEVEL_INFO);
+  Log.info("Counted %d", 1);
+  LOG_WARNING(Log, "Counted too");
+  Log.debug("Filtered");
+  evaluations_ = 0;
+  LOG_TRACE(Log, "Filtered %d", counted_value());
+  std::string long_value(LOG_LINE_BUFFER_SIZE * 2, 'a');
+  Log.error("%s", long_value.c_str());
+  // A guard of the application's own is not a filtered call
+  TEST_ASSERT_FALSE(Log.isEnabled(LOG_LEVEL_DEBUG));
+
+  LogStatistics statistics;
+  Logging::getStatistics(statistics);
+  TEST_ASSERT_EQUAL_INT(0, evaluations_);
+  TEST_ASSERT_EQUAL_INT(1, statistics.messages[LOG_LEVEL_ERROR]);
+  TEST_ASSERT_EQUAL_INT(1, statistics.messages[LOG_LEVEL_WARNING]);
+  TEST_ASSERT_EQUAL_INT(1, statistics.messages[LOG_LEVEL_INFO]);
+  TEST_ASSERT_EQUAL_INT(0, statistics.messages[LOG_LEVEL_DEBUG]);
+  TEST_ASSERT_EQUAL_INT(2, statistics.filtered);
+  TEST_ASSERT_EQUAL_INT(11 + 13 + LOG_LINE_BUFFER_SIZE, statistics.bytes);
+  TEST_ASSERT_EQUAL_INT(1, statistics.truncated);
+  TEST_ASSERT_EQUAL_INT(15, statistics.totalMicros);
+  TEST_ASSERT_EQUAL_INT(5, statistics.maxMicros);
+
+  StringOutput report;
+  Logging::printStatistics(report);
+  std::string expected_report =
+      "messages CRIT=0 ERRO=1 WARN=1 INFO=1 DBUG=0 TRCE=0\r\n"
+      "filtered=2 bytes=" + std::to_string(11 + 13 + LOG_LINE_BUFFER_SIZE) +
+      " truncated=1 dropped=0 time=15us max=5us\r\n";
+  TEST_ASSERT_EQUAL_STRING(expected_report.c_str(), report.lines.c_str());
+  Logging::resetStatistics();
+  Logging::getStatistics(statistics);
+  TEST_ASSERT_EQUAL_INT(0, statistics.messages[LOG_LEVEL_INFO]);
+  TEST_ASSERT_EQUAL_INT(0, statistics.bytes);
+
+#if LOG_ASYNC_BUFFER_SIZE > 0
+  // Lines the asynchronous buffer dropped are not counted as written
+  StringOutput lines;
+  Logging::setOutput(&lines);
+  Logging::setAsync(true);
+  for (int i = 0; i < LOG_ASYNC_BUFFER_SIZE / 8; ++i) {
+    Log.info("Line %d", i);
+  }
+  Logging::setAsync(false);
+  Logging::getStatistics(statistics);
+  TEST_ASSERT_TRUE(statistics.dropped > 0);
+  TEST_ASSERT_EQUAL_INT((int)lines.lines.size(), statistics.bytes);
+  Logging::resetStatistics();
+#endif
+}
+
+void test_hexdump() {
+  reset_output();
+  const uint8_t packet[] = {'H', 'e', 'l', 'l', 'o', 0x00, 0x7F, 0xFF,
+                            0x10, '!', 'a',  'b',  'c', 'd', 'e', 'f',
+                            'g', '\r', '\n'};
+  Log.info("Buffer specifier               : %h", packet, 4);
+  LOG_INFO(Log, "Compiled buffer specifier      : %h", packet, sizeof(packet) - 16);
+  Log.info("Negative length                : [%h]", packet, -1);
+  LOG_INFO(Log, "Compiled negative length       : [%h]", packet, -1);
+  Logging::setPrefix("%L ");
+  Log.hexdump(LOG_LEVEL_DEBUG, packet, sizeof(packet));
+  Log.hexdump(LOG_LEVEL_DEBUG, packet, 5, false);
+  Logging::clearPrefix();
+  std::stringstream expected_output;
+  expected_output
+      << "Buffer specifier               : 48 65 6C 6C\n"
+         "Compiled buffer specifier      : 48 65 6C\n"
+         "Negative length                : []\n"
+         "Compiled negative length       : []\n"
+         "DBUG 0x0000: 48 65 6C 6C 6F 00 7F FF 10 21 61 62 63 64 65 66  Hello....!abcdef\n"
+         "DBUG 0x0010: 67 0D 0A                                         g..\n"
+         "DBUG 0x0000: 48 65 6C 6C 6F\n";
+  TEST_ASSERT_EQUAL_STRING_STREAM(expected_output, output_);
+  TEST_ASSERT_EQUAL_INT(7, write_calls_);
+}
+
+void test_structured_event() {
+  reset_output();
+  Logging::setClock(fixed_clock);
+  Logging net("Net");
+  LogEvent(net, LOG_LEVEL_INFO, "reading")
+      .add("sensor", 3).add("temp", 21.5).add("ok", true).add("unit", F("\"C\""));
+  LogEvent(Log, LOG_LEVEL_DEBUG, F("no module")).add("missing", (const char *)nullptr);
+  std::stringstream expected_output;
+  expected_output
+      << "{\"time\":3723004,\"level\":\"INFO\",\"module\":\"Net\",\"msg\":\"reading\","
+         "\"sensor\":3,\"temp\":21.50,\"ok\":true,\"unit\":\"\\\"C\\\"\"}\n"
+         "{\"time\":3723004,\"level\":\"DBUG\",\"msg\":\"no module\",\"missing\":null}\n";
+  TEST_ASSERT_EQUAL_STRING_STREAM(expected_output, output_);
+
+  // Binary mode: an event frame holding a CBOR map
+  reset_output();
+  Logging::setBinaryMode(true);
+  LogEvent(net, LOG_LEVEL_INFO, "r").add("t", 1.5).add("n", -300).add("b", false);
+  Logging::setBinaryMode(false);
+  Logging::setClock(nullptr);
+  const unsigned char expected[] = {
+      0xA5, 'E', 33,
+      0xBF, 0x00, 0x1A, 0x00, 0x38, 0xCE, 0xFC, 0x01, 0x04, 0x02, 0x63, 'N', 'e', 't', 0x03, 0x61, 'r',
+      0x61, 't', 0xFA, 0x3F, 0xC0, 0x00, 0x00, 0x61, 'n', 0x39, 0x01, 0x2B, 0x61, 'b', 0xF4, 0xFF};
+  std::string actual = output_.str();
+  TEST_ASSERT_EQUAL_INT(sizeof(expected), actual.size());
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, actual.data(), sizeof(expected));
+}
+
+void test_event_overflow() {
+  // Fields that no longer fit in the record are left out whole and counted under key 4
+  reset_output();
+  Logging::setClock(fixed_clock);
+  Logging::setBinaryMode(true);
+  {
+    LogEvent event(Log, LOG_LEVEL_INFO, "r");
+    for (int i = 0; i < 40; i++) {
+      event.add("k", 1000);
+    }
+  }
+  Logging::setBinaryMode(false);
+  Logging::setClock(nullptr);
+
+  const size_t header = 12, field = 5;
+  size_t room = LogRecord::kMaxPayload < LogLine::capacity() ? LogRecord::kMaxPayload : LogLine::capacity();
+  size_t fields = (room - 3 - header) / field;
+  size_t dropped = 40 - fields > 9 ? 9 : 40 - fields;
+  std::string expected("\xA5" "E", 2);
+  expected += (char) (header + fields * field + 3);
+  expected += std::string("\xBF\x00\x1A\x00\x38\xCE\xFC\x01\x04\x03\x61r", header);
+  for (size_t i = 0; i < fields; i++) {
+    expected += std::string("\x61k\x19\x03\xE8", field);
+  }
+  expected += std::string("\x04", 1);
+  expected += (char) dropped;
+  expected += std::string("\xFF", 1);
+  std::string actual = output_.str();
+  TEST_ASSERT_EQUAL_INT(expected.size(), actual.size());
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(expected.data(), actual.data(), expected.size());
+}
+
+void test_batched_output() {
+  reset_output();
+  Logging::setClock(test_clock);
+  test_time_ = 1000;
+  Logging::setBatching(true, 100, LOG_LEVEL_ERROR);
+  Log.info("Batched line %d", 1);
+  LOG_WARNING(Log, "Batched line %d", 2);
+  TEST_ASSERT_EQUAL_INT(0, write_calls_);
+  // An error flushes the block at once, in one write
+  Log.error("Batched line %d", 3);
+  TEST_ASSERT_EQUAL_INT(1, write_calls_);
+
+  // So does the age of the first line in the block
+  Log.info("Batched line %d", 4);
+  test_time_ += 99;
+  Logging::flushIfDue();
+  TEST_ASSERT_EQUAL_INT(1, write_calls_);
+  test_time_ += 1;
+  Logging::flushIfDue();
+  TEST_ASSERT_EQUAL_INT(2, write_calls_);
+
+  Log.info("Batched line %d", 5);
+  Logging::flush();
+  TEST_ASSERT_EQUAL_INT(3, write_calls_);
+  Logging::setBatching(false);
+  Logging::setClock(nullptr);
+
+  std::stringstream expected_output;
+  expected_output << "Batched line 1\n"
+                     "Batched line 2\n"
+                     "Batched line 3\n"
+                     "Batched line 4\n"
+                     "Batched line 5\n";
+  TEST_ASSERT_EQUAL_STRING_STREAM(expected_output, output_);
+}
+
+void test_width_and_padding() {
+  reset_output();
+  Log.info("Width and alignment            : [%5d][%-5d][%6s][%-6s]", 42, 42, "ab", "ab");
+  Log.info("Zero padding                   : [%05d][%08x][%08X][%08.2f]", -42, 0xBEEFu, 0x12u, -1.5);
+  Log.info("Precision                      : [%.3d][%.3s][%8.3f][%5.3d]", 7, "abcdef", 3.14159, -7);
+  Log.info(F("Flash format                   : [%-6S][%04d][%6.1f]"), F("fl"), 9, 2.25);
+  LOG_INFO(Log, "Compiled format                : [%5d][%-6s][%08x][%.3s][%-4L]", 42, "ab", 0xBEEFu, "abcdef");
+  std::stringstream expected_output;
+  expected_output
+      << "Width and alignment            : [   42][42   ][    ab][ab    ]\n"
+         "Zero padding                   : [-0042][0000BEEF][0x000012][-0001.50]\n"
+         "Precision                      : [007][abc][   3.142][ -007]\n"
+         "Flash format                   : [fl    ][0009][   2.3]\n"
+         "Compiled format                : [   42][ab    ][0000BEEF][abc][INFO]\n";
+  TEST_ASSERT_EQUAL_STRING_STREAM(expected_output, output_);
+}
+
+void timed_call(LogProbe &probe, unsigned long elapsed) {
+  LogTimer timer(Log, LOG_LEVEL_DEBUG, probe);
+  test_time_ += elapsed;
+}
+
+void test_scope_timer() {
+  reset_output();
+  LogTimer::setClock(test_clock);
+  test_time_ = 1000;
+  {
+    LogTimer timer(Log, LOG_LEVEL_DEBUG, "Scope timer");
+    test_time_ += 250;
+  }
+  {
+    LOG_SCOPE_TIMER(Log, LOG_LEVEL_DEBUG, "Below threshold", 100);
+    test_time_ += 99;
+  }
+  {
+    LOG_SCOPE_TIMER(Log, LOG_LEVEL_DEBUG, "Above threshold", 100);
+    test_time_ += 100;
+  }
+
+  // A probe reports once its interval passed since its first time
+  LogProbe probe("Probe", 10);
+  timed_call(probe, 10);
+  timed_call(probe, 30);
+  TEST_ASSERT_EQUAL_INT(2, write_calls_);
+  test_time_ += 10000;
+  timed_call(probe, 20);
+  LogTimer::setClock(nullptr);
+
+  std::stringstream expected_output;
+  expected_output << "Scope timer: 250 us\n"
+                     "Above threshold: 100 us\n"
+                     "Probe: n=3 min=10 max=30 mean=20 us\n";
+  TEST_ASSERT_EQUAL_STRING_STREAM(expected_output, output_);
+}
+
+#if LOG_THREAD_SAFE
+void concurrent_line(Logging &logger, int t, int n) {
+  if (n % 2 == 1) {
+    LOG_PRINT(logger, LOG_LEVEL_ERROR + t, "line %d, long enough to be torn %s",
+              n, "apart");
+  } else if (t == 0) {
+    logger.error("line %d, long enough to be torn %s", n, "apart");
+  } else if (t == 1) {
+    logger.warning("line %d, long enough to be torn %s", n, "apart");
+  } else if (t == 2) {
+    logger.info("line %d, long enough to be torn %s", n, "apart");
+  } else {
+    logger.debug("line %d, long enough to be torn %s", n, "apart");
+  }
+}
+
+void test_concurrent_lines() {
+  // Each thread logs at a level of its own, half through the methods and half
+  // through the compiled formats, and no line may be torn or take the level of
+  // another thread.
+  const int kThreads = 4;
+  const int kLines = 500;
+  StringOutput lines;
+  Logging::setOutput(&lines);
+  Logging::setPrefix("%L %n ");
+  Logging loggers[kThreads] = {Logging("T0"), Logging("T1"), Logging("T2"),
+                               Logging("T3")};
+  std::thread threads[kThreads];
+  for (int t = 0; t < kThreads; ++t) {
+    threads[t] = std::thread([&loggers, t]() {
+      for (int n = 0; n < kLines; ++n) {
+        concurrent_line(loggers[t], t, n);
+      }
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  Logging::clearPrefix();
+
+  static const char *const kAbbrevs[] = {"ERRO", "WARN", "INFO", "DBUG"};
+  int next[kThreads] = {0};
+  size_t start = 0;
+  size_t end;
+  while ((end = lines.lines.find("\r\n", start)) != std::string::npos) {
+    std::string line = lines.lines.substr(start, end - start);
+    start = end + 2;
+    TEST_ASSERT_TRUE(line.size() > 7 && line[5] == 'T');
+    int t = line[6] - '0';
+    TEST_ASSERT_TRUE(t >= 0 && t < kThreads);
+    char expected[96];
+    snprintf(expected, sizeof(expected),
+             "%s T%d line %d, long enough to be torn apart", kAbbrevs[t], t,
+             next[t]++);
+    TEST_ASSERT_EQUAL_STRING(expected, line.c_str());
+  }
+  TEST_ASSERT_EQUAL_size_t(lines.lines.size(), start);
+  for (int t = 0; t < kThreads; ++t) {
+    TEST_ASSERT_EQUAL_INT(kLines, next[t]);
+  }
+}
+
+void test_async_blocking_drain() {
+  // A log call waiting for room in a full buffer must not keep the drain thread
+  // from writing, or neither makes progress.
+  const int kLines = 2000;
+  StringOutput lines;
+  Logging::setOutput(&lines);
+  Logging::setAsync(true);
+  Logging::setOverflowPolicy(LOG_OVERFLOW_BLOCK);
+  std::atomic<bool> done(false);
+  std::thread drainer([&done]() {
+    while (!done.load()) {
+      Logging::drain();
+      std::this_thread::yield();
+    }
+  });
+  for (int n = 0; n < kLines; ++n) {
+    Log.info("Blocking line %d", n);
+  }
+  done = true;
+  drainer.join();
+  Logging::setAsync(false);
+  Logging::setOverflowPolicy(LOG_OVERFLOW_DROP_NEWEST);
+
+  std::string expected;
+  for (int n = 0; n < kLines; ++n) {
+    expected += "Blocking line " + std::to_string(n) + "\r\n";
+  }
+  TEST_ASSERT_TRUE(expected == lines.lines);
+}
+
+// Several producers and a drain thread: every line arrives whole, at most once
+// and in the order of its producer, and those that do not arrive are counted as
+// dropped. Under LOG_OVERFLOW_BLOCK all of them arrive.
+void async_producers(uint8_t policy) {
+  const int kThreads = 4;
+  const int kLines = 500;
+  StringOutput lines;
+  Logging::setOutput(&lines);
+  uint32_t dropped = Logging::getDroppedCount();
+  Logging::setAsync(true);
+  Logging::setOverflowPolicy(policy);
+  std::atomic<bool> done(false);
+  std::thread drainer([&done]() {
+    while (!done.load()) {
+      Logging::drain();
+      std::this_thread::yield();
+    }
+  });
+  std::thread producers[kThreads];
+  for (int t = 0; t < kThreads; ++t) {
+    producers[t] = std::thread([t]() {
+      for (int n = 0; n < kLines; ++n) {
+        Log.info("Producer %d line %d", t, n);
+      }
+    });
+  }
+  for (std::thread &producer : producers) {
+    producer.join();
+  }
+  done = true;
+  drainer.join();
+  Logging::drain();
+  Logging::setAsync(false);
+  Logging::setOverflowPolicy(LOG_OVERFLOW_DROP_NEWEST);
+  dropped = Logging::getDroppedCount() - dropped;
+
+  int next[kThreads] = {0};
+  int received = 0;
+  size_t start = 0;
+  size_t end;
+  while ((end = lines.lines.find("\r\n", start)) != std::string::npos) {
+    std::string line = lines.lines.substr(start, end - start);
+    start = end + 2;
+    int t;
+    int n;
+    char extra;
+    TEST_ASSERT_EQUAL_INT(2, sscanf(line.c_str(), "Producer %d line %d%c", &t, &n, &extra));
+    TEST_ASSERT_TRUE(t >= 0 && t < kThreads);
+    TEST_ASSERT_TRUE(n >= next[t] && n < kLines);
+    next[t] = n + 1;
+    ++received;
+  }
+  TEST_ASSERT_EQUAL_size_t(lines.lines.size(), start);
+  TEST_ASSERT_EQUAL_INT(kThreads * kLines, received + (int)dropped);
+  if (policy == LOG_OVERFLOW_BLOCK) {
+    TEST_ASSERT_EQUAL_INT(0, dropped);
+  }
+}
+
+void test_async_producers() {
+  async_producers(LOG_OVERFLOW_DROP_NEWEST);
+  async_producers(LOG_OVERFLOW_DROP_OLDEST);
+  async_producers(LOG_OVERFLOW_BLOCK);
+}
+
+// Reads _logOutput from another thread while a deprecated override renders into
+// its line
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+class ThreadLegacyLogging : public Logging {
+public:
+  Print *seen = nullptr;
+  using Logging::printInternal;
+  void printInternal(char format) override {
+    std::thread other([this]() { seen = _logOutput; });
+    other.join();
+    _logOutput->print("legacy");
+  }
+};
+#pragma GCC diagnostic pop
+
+void test_legacy_output_per_thread() {
+  reset_output();
+  ThreadLegacyLogging legacy;
+  Logging::setPrefix("[%X] ");
+  legacy.info("Own line");
+  Logging::clearPrefix();
+  TEST_ASSERT_TRUE(legacy.seen == &Serial);
+  std::stringstream expected_output;
+  expected_output << "[legacy] Own line\n";
+  TEST_ASSERT_EQUAL_STRING_STREAM(expected_output, output_);
+}
+#endif
+
 int main(int argc, char **argv) {
   UNITY_BEGIN();
   RUN_TEST(test_int_values);
   RUN_TEST(test_int_hex_values);
+  RUN_TEST(test_integer_widths);
   RUN_TEST(test_int_binary_values);
   RUN_TEST(test_long_values);
   RUN_TEST(test_bool_values);
   RUN_TEST(test_char_string_values);
   RUN_TEST(test_flash_string_values);
+  RUN_TEST(test_flash_format);
   RUN_TEST(test_string_values);
   RUN_TEST(test_float_values);
-  // RUN_TEST(test_double_values);
+  RUN_TEST(test_double_values);
+  RUN_TEST(test_float_precision);
   RUN_TEST(test_mixed_values);
   RUN_TEST(test_log_levels);
   RUN_TEST(test_internal_log_level);
   RUN_TEST(test_internal_threshold_level);
   RUN_TEST(test_internal_module_name);
-  // RUN_TEST(test_combined_internal_variables);
+  RUN_TEST(test_combined_internal_variables);
+  RUN_TEST(test_custom_clock);
+  RUN_TEST(test_prefix_format);
+  RUN_TEST(test_legacy_print_internal);
+  RUN_TEST(test_legacy_print_format);
+  RUN_TEST(test_single_write_per_line);
+  RUN_TEST(test_truncated_line);
+  RUN_TEST(test_compiled_format);
+  RUN_TEST(test_compiled_enum);
+  RUN_TEST(test_lazy_arguments);
+  RUN_TEST(test_binary_mode);
+  RUN_TEST(test_binary_long_format);
+  RUN_TEST(test_async_output);
+  RUN_TEST(test_async_overflow);
+  RUN_TEST(test_async_binary_overflow);
+  RUN_TEST(test_module_levels);
+  RUN_TEST(test_multiple_outputs);
+  RUN_TEST(test_rate_limit);
+  RUN_TEST(test_sampling);
+  RUN_TEST(test_flight_recorder);
+  RUN_TEST(test_flight_recorder_moved_format);
+  RUN_TEST(test_flight_recorder_other_build);
+  RUN_TEST(test_statistics);
+  RUN_TEST(test_hexdump);
+  RUN_TEST(test_structured_event);
+  RUN_TEST(test_event_overflow);
+  RUN_TEST(test_batched_output);
+  RUN_TEST(test_width_and_padding);
+  RUN_TEST(test_scope_timer);
+#if LOG_THREAD_SAFE
+  RUN_TEST(test_concurrent_lines);
+  RUN_TEST(test_async_blocking_drain);
+  RUN_TEST(test_async_producers);
+  RUN_TEST(test_legacy_output_per_thread);
+#endif
   UNITY_END();
 }